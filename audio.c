@@ -0,0 +1,282 @@
+// audio output thread for theremin player
+// copyright simulistics ltd
+// control loop pushes targets through a lock-free queue per voice,
+// render thread makes fixed-size blocks and blocks only in the sink;
+// with several instruments, helper threads render some voices each
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include "synth.h"
+#include "fx.h"
+#include "sense.h"
+#include "audio.h"
+#include "voice.h"
+#include "stats.h"
+#include "rt.h"
+#include "trace.h"
+
+static struct voice { // one per instrument
+  // single producer (control loop), single consumer (render thread)
+  struct ctl ctlQueue[CTL_QUEUE];
+  atomic_uint ctlHead, ctlTail;
+
+  struct ctl tgt;
+  struct prompt *speech;
+  struct timespec sensed; // of reading first heard in this block
+  struct osc osc;
+  struct fx fx;
+  long fxNs, fxMaxNs, fxBlocks; // cost of effects since last block
+  pitch_t pitchAdj;
+  vol_t volAdj;
+  int ramp, said;
+  int16_t buffer[MAX_BLOCK]; // own output, before mixing
+} voices[MAX_INST];
+
+int nVoices = 1;
+int period = PERIOD, nPeriods = NPERIODS;
+int fillTarget = 0;
+static int writeLen = PERIOD; // of block being played, ramps span it
+
+// helpers each render every nGroups'th voice, render thread does group 0
+static int nGroups = 1, nHelpers = 0, blockLen;
+static sem_t helperGo[MAX_INST], helpersDone;
+
+// returns 0 if queue full, render thread must be stuck
+int sendCtl(int n, struct ctl *c) {
+  struct voice *vc = voices + n;
+  unsigned int head = atomic_load_explicit(&vc->ctlHead, memory_order_relaxed);
+
+  if (head - atomic_load_explicit(&vc->ctlTail, memory_order_acquire)
+      == CTL_QUEUE)
+    return 0;
+  vc->ctlQueue[head%CTL_QUEUE] = *c;
+  atomic_store_explicit(&vc->ctlHead, head+1, memory_order_release);
+  return 1;
+}
+
+static int getCtl(struct voice *vc, struct ctl *c) {
+  unsigned int tail = atomic_load_explicit(&vc->ctlTail, memory_order_relaxed);
+
+  if (tail == atomic_load_explicit(&vc->ctlHead, memory_order_acquire))
+    return 0;
+  *c = vc->ctlQueue[tail%CTL_QUEUE];
+  atomic_store_explicit(&vc->ctlTail, tail+1, memory_order_release);
+  return 1;
+}
+
+// apply any new targets then synthesize n frames of one voice
+static void renderVoice(struct voice *vc, int16_t *buffer, int n) {
+  struct ctl c;
+  struct timespec t0, t1;
+  long ns;
+  int i = 0, j, fresh = 0, under = duck*32768;
+
+  vc->sensed.tv_sec = vc->sensed.tv_nsec = 0;
+  while (getCtl(vc, &c)) { // only latest targets matter
+    if (!vc->sensed.tv_sec) // oldest reading waited longest
+      vc->sensed = c.sensed;
+    if (c.speech) { // newest prompt cuts off any before
+      vc->speech = c.speech;
+      vc->said = 0;
+    }
+    vc->tgt = c;
+    fresh = 1;
+  }
+  if (fresh) { // reach targets by the end of this write, when more come
+    vc->ramp = MAX(writeLen, RAMP_MIN);
+    if (vc->tgt.glide) // change pitch smoothly
+      vc->pitchAdj = (vc->tgt.pitch - vc->osc.pitch)/vc->ramp;
+    else { // change pitch abruptly
+      vc->osc.pitch = vc->tgt.pitch;
+      vc->pitchAdj = 0;
+    }
+    vc->volAdj = (vc->tgt.vol - vc->osc.vol)/vc->ramp;
+    fxSet(&vc->fx, vc->tgt.fx);
+  }
+
+  if (vc->ramp) { // adjust gradually to avoid crackle
+    i = MIN(n, vc->ramp);
+    renderTone(&vc->osc, buffer, i, vc->tgt.tone, vc->pitchAdj, vc->volAdj);
+    vc->ramp -= i;
+  }
+  if (i<n)
+    renderTone(&vc->osc, buffer+i, n-i, vc->tgt.tone, 0, 0);
+  if (fxActive(&vc->fx)) { // timed, to see how many the board can take
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    fxProcess(&vc->fx, buffer, n);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns = (t1.tv_sec-t0.tv_sec)*1000000000 + t1.tv_nsec-t0.tv_nsec;
+    vc->fxNs += ns;
+    vc->fxMaxNs = MAX(vc->fxMaxNs, ns);
+    ++vc->fxBlocks;
+  }
+
+  if (vc->speech) { // say it over tone turned down
+    for (i=0; i<n && vc->said<vc->speech->len; ++i) {
+      j = (under*buffer[i] >> 15) + vc->speech->data[vc->said++];
+      buffer[i] = j > 32767 ? 32767 : j < -32768 ? -32768 : j;
+    }
+    if (vc->said == vc->speech->len)
+      vc->speech = NULL;
+  }
+}
+
+static void renderGroup(int g) {
+  int v;
+
+  TRACE_BEGIN("voices");
+  for (v=g; v<nVoices; v+=nGroups)
+    renderVoice(voices+v, voices[v].buffer, blockLen);
+  TRACE_END("voices");
+}
+
+static void* helperLoop(void* arg) {
+  int g = (intptr_t)arg;
+
+  for (;;) {
+    while (sem_wait(&helperGo[g]))
+      ;
+    renderGroup(g);
+    sem_post(&helpersDone);
+  }
+  return NULL;
+}
+
+// all voices mixed, n frames up to MAX_BLOCK
+void renderBlock(int16_t *buffer, int n) {
+  int g, i, v, sum;
+
+  if (nVoices == 1) { // nothing to mix
+    renderVoice(voices, buffer, n);
+    return;
+  }
+  blockLen = n;
+  for (g=1; g<nGroups; ++g)
+    sem_post(&helperGo[g]);
+  renderGroup(0);
+  for (g=1; g<nGroups; ++g)
+    while (sem_wait(&helpersDone))
+      ;
+
+  for (i=0; i<n; ++i) {
+    for (v=sum=0; v<nVoices; ++v)
+      sum += voices[v].buffer[i];
+    buffer[i] = sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+  }
+}
+
+// n instruments, spread over as many cores as will help
+void setVoices(int n) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int v;
+
+  nVoices = MIN(MAX(n, 1), MAX_INST);
+  for (v=0; v<nVoices; ++v)
+    if (!voices[v].fx.lines && !fxAlloc(&voices[v].fx)) {
+      fprintf(stderr, "No memory for effects\n");
+      exit(EXIT_FAILURE);
+    }
+  nGroups = MIN(nVoices, MAX(cpus, 1));
+  if (nGroups > 1 && !nHelpers)
+    sem_init(&helpersDone, 0, 0);
+  for (; nHelpers < nGroups-1; ++nHelpers) {
+    sem_init(&helperGo[nHelpers+1], 0, 0);
+    startThread(RT_HELPER, helperLoop, (void*)(intptr_t)(nHelpers+1));
+  }
+}
+
+// render and output a block, in place if sink allows, noting how long
+// new readings took; buffer is only used if sink can't render in place
+void playBlock(int16_t *buffer, int n) {
+  int16_t *area;
+  long queued;
+  int v, done, got;
+
+  writeLen = n;
+  if (sink->begin)
+    for (done=0; done<n; done+=got) { // in pieces if device ring wraps
+      got = n-done;
+      TRACE_BEGIN("sink wait");
+      if (!(area = sink->begin(&got)))
+	exit(EXIT_FAILURE);
+      TRACE_END("sink wait");
+      TRACE_BEGIN("render");
+      renderBlock(area, got);
+      TRACE_END("render");
+      TRACE_BEGIN("sink commit");
+      if (sink->commit(got) < 0)
+	exit(EXIT_FAILURE);
+      TRACE_END("sink commit");
+    }
+  else {
+    TRACE_BEGIN("render");
+    renderBlock(buffer, n);
+    TRACE_END("render");
+    TRACE_BEGIN("sink write");
+    if (sink->write(buffer, n) < 0)
+      exit(EXIT_FAILURE);
+    TRACE_END("sink write");
+  }
+  ++stats->blocks;
+  for (v=0; v<nVoices; ++v) // helpers are done, so safe to gather
+    if (voices[v].fxBlocks) {
+      stats->fxBlocks += voices[v].fxBlocks;
+      stats->fxNs += voices[v].fxNs;
+      stats->fxMaxNs = MAX(stats->fxMaxNs, voices[v].fxMaxNs);
+      voices[v].fxBlocks = voices[v].fxNs = voices[v].fxMaxNs = 0;
+    }
+  queued = sink->delay() - n; // start of block is this far from heard
+  if (queued < 0) queued = 0;
+  stats->queuedSum += queued + n/2; // mean while this block drains
+  stats->writeSum += n;
+  for (v=0; v<nVoices; ++v)
+    if (voices[v].sensed.tv_sec)
+      noteLatency(&voices[v].sensed, queued);
+}
+
+// frames to write so the device holds fillTarget plus a period once
+// they are in, after sleeping till it has drained down to fillTarget;
+// the error left by sleeping or the device's own timing comes straight
+// off the next write, so the level can't drift; never more than the
+// device buffer holds, or the sink would wait for room for good
+static int nextWrite() {
+  struct timespec tv;
+  long queued = sink->delay();
+  long long ns;
+
+  if (queued > fillTarget) {
+    ns = (queued - fillTarget)*1000000000LL/PCM_RATE;
+    tv.tv_sec = ns/1000000000;
+    tv.tv_nsec = ns%1000000000;
+    TRACE_BEGIN("fill wait");
+    nanosleep(&tv, NULL);
+    TRACE_END("fill wait");
+    queued = sink->delay();
+  }
+  return MIN(MAX(fillTarget + period - queued, MIN_WRITE),
+	     MIN(period*nPeriods, MAX_BLOCK));
+}
+
+static void* renderLoop(void* dump) {
+  int16_t buffer[MAX_BLOCK];
+
+  for (;;) // a period at a time as buffer allows, or to hold a level
+    playBlock(buffer, fillTarget ? nextWrite() : period);
+  return NULL;
+}
+
+void startAudio(int n) {
+  if (!sink && !openSink("alsa"))
+    exit(EXIT_FAILURE);
+  setVoices(n);
+  startThread(RT_AUDIO, renderLoop, NULL);
+}
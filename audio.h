@@ -0,0 +1,44 @@
+// audio output thread for theremin player
+// copyright simulistics ltd
+
+// needs synth.h, fx.h and time.h
+
+#define PERIOD		256 // default frames rendered per block
+#define NPERIODS	3 // default blocks held by device, sets output latency
+#define RAMP_MIN	(PCM_RATE/1000) // shortest glide to new target, frames
+#define CTL_QUEUE	64 // control messages in flight, power of 2
+#define MAX_BLOCK	4096 // most frames rendered at once
+#define MIN_WRITE	16 // fewest written when holding a fill level
+
+struct ctl { // sent from control loop to render thread
+  pitch_t pitch; // targets
+  vol_t vol;
+  int tone, glide; // glide to target pitch rather than jump
+  struct prompt *speech; // new prompt to say over tone, or NULL
+  int fx[NFX]; // effect amounts, 0 is off
+  struct timespec sensed; // when reading was taken, 0 if not sensed
+};
+
+struct sink { // where rendered audio goes
+  char *name;
+  int (*open)(char *arg);
+  int (*write)(int16_t *buffer, int n); // frames written, <0 if fatal
+  // or render in place: room for up to *n frames, NULL if fatal,
+  // then commit frames rendered there, <0 if fatal
+  int16_t *(*begin)(int *n);
+  int (*commit)(int n);
+  long (*delay)(); // frames written but not yet heard
+  void (*close)();
+};
+
+extern struct sink *sink;
+extern int nVoices;
+extern int period, nPeriods; // asked of sink, it may change them
+extern int fillTarget; // frames to keep queued, 0 to fill the buffer
+
+int openSink(char *spec);
+int sendCtl(int n, struct ctl *c);
+void renderBlock(int16_t *buffer, int n);
+void playBlock(int16_t *buffer, int n);
+void setVoices(int n);
+void startAudio(int n);
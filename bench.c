@@ -0,0 +1,966 @@
+// performance checks for theremin code, no hardware needed
+// copyright simulistics ltd
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <linux/spi/spidev.h>
+
+#include "synth.h"
+#include "fx.h"
+#include "scan.h"
+#include "spi.h"
+#include "fakespi.h"
+#include "tune.h"
+#include "est.h"
+#include "sense.h"
+#include "snap.h"
+#include "stats.h"
+#include "stream.h"
+#include "edges.h"
+#include "pcm.h"
+#include "trace.h"
+
+#define BENCH_SAMPLES (20*PCM_RATE)
+
+#ifdef FIXED
+#define BUILD "fixed"
+#else
+#define BUILD "float"
+#endif
+
+volatile int keep; // results go here so optimiser can't drop the work
+
+// tables for people on stdout, or with -c on stderr while stdout gets
+// one CSV row per result: machine,build,bench,case,metric,value
+static FILE *tbl;
+static int csv = 0;
+static struct utsname host;
+
+static void record(char *bench, char *metric, double value,
+		   char *fmt, ...) {
+  va_list ap;
+
+  if (!csv)
+    return;
+  printf("%s,%s,%s,", host.machine, BUILD, bench);
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf(",%s,%.6g\n", metric, value);
+}
+
+static double elapsed(struct timespec *t0) {
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec-t0->tv_sec) + 1e-9*(t1.tv_nsec-t0->tv_nsec);
+}
+
+static pitch_t pitchOf(double hz) {
+#ifdef FIXED
+  return hz*4294967296.0/PCM_RATE;
+#else
+  return hz;
+#endif
+}
+
+#define BLOCK 256
+
+#ifdef FIXED
+#define STEP(hz) ((pitch_t)((hz)*4294967296.0/PCM_RATE))
+
+// integer path against float maths on the same phase and volume,
+// float path truncates towards zero so compare with that
+static void benchFixed() {
+  static int16_t out[BLOCK];
+  struct osc o;
+  struct timespec t0;
+  pitch_t pitchAdj, pitch;
+  vol_t volAdj, vol;
+  uint32_t phase;
+  double sq, tFix;
+  int t, b, i, d, worst, nBlocks = BENCH_SAMPLES/BLOCK;
+
+  initWaves();
+  fprintf(tbl, "tone       fixed S/s   max err  rms err  bound %d\n",
+	  FIX_ERROR);
+  for (t=0; t<NTONES; ++t) {
+    o.phase = 0; o.pitch = STEP(200); o.vol = VOL_ONE/5;
+    worst = 0;
+    sq = 0;
+    for (b=0; b<nBlocks; ++b) {
+      pitchAdj = STEP((b%2 ? -1.0 : 1.3)/BLOCK); // glide up and down
+      volAdj = (b%3 ? 1 : -2)*(VOL_ONE/10/nBlocks);
+      phase = o.phase; pitch = o.pitch; vol = o.vol;
+      renderTone(&o, out, BLOCK, t, pitchAdj, volAdj);
+      for (i=0; i<BLOCK; ++i) {
+	pitch += pitchAdj;
+	phase += pitch;
+	vol += volAdj;
+	d = abs(out[i] - (int)(32768.0*vol/VOL_ONE*
+			       waveSample(t, phase/4294967296.0)));
+	if (d > worst) worst = d;
+	sq += (double)d*d;
+      }
+    }
+    o.phase = 0; o.pitch = STEP(200); o.vol = VOL_ONE/5;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (b=0; b<nBlocks; ++b)
+      renderTone(&o, out, BLOCK, t, STEP((b%2 ? -1.0 : 1.3)/BLOCK), 0);
+    tFix = elapsed(&t0);
+    keep = out[1];
+    fprintf(tbl, "%-10s %10.0lf  %7d  %7.2lf  %s\n", toneNames[t],
+	    nBlocks*BLOCK/tFix, worst, sqrt(sq/(nBlocks*BLOCK)),
+	    worst <= FIX_ERROR ? "ok" : "EXCEEDED");
+    record("synth", "ns/sample", 1e9*tFix/(nBlocks*BLOCK), "%s",
+	   toneNames[t]);
+    record("synth", "max err", worst, "%s", toneNames[t]);
+  }
+}
+
+// control maths tables against libm, errors in cents
+static void benchFixMath() {
+  double err, worstLog = 0, worstExp = 0;
+  uint32_t x;
+  int32_t y;
+
+  for (x=1; x<1U<<30; x += x/1000+1) {
+    err = fabs(fixLog2(x)/65536.0 - log2(x))*1200;
+    if (err > worstLog) worstLog = err;
+  }
+  for (y=-65536; y<30*65536; y += 97) {
+    if (fixExp2(y) < 1<<20) continue; // coarser than pitchFor uses
+    err = fabs(log2(fixExp2(y)) - y/65536.0)*1200;
+    if (err > worstExp) worstExp = err;
+  }
+  fprintf(tbl, "fixed log2 max err %.4lf cents, exp2 max err %.4lf cents\n",
+	  worstLog, worstExp);
+  record("fixmath", "max err cents", worstLog, "log2");
+  record("fixmath", "max err cents", worstExp, "exp2");
+}
+
+#else
+// render loop as in player, pitch sweeping, either way of getting wave
+static double renderRate(int tone, int useTable) {
+  static int16_t buffer[PCM_RATE/25];
+  struct timespec t0;
+  double phase = 0, curPitch = 200, pitchAdj = 1000.0/BENCH_SAMPLES,
+    curVol = 0.2, volAdj = 0.5/BENCH_SAMPLES;
+  unsigned int i, j;
+  int sum = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i=0; i<BENCH_SAMPLES; ) {
+    for (j=0; j<PCM_RATE/25; ++j, ++i) {
+      curPitch += pitchAdj;
+      curVol += volAdj;
+      if (useTable) {
+	phase += curPitch/PCM_RATE;
+	phase -= (int)phase;
+	buffer[j] = 32768*curVol*waveSample(tone, phase);
+      } else {
+	phase = fmod(phase+curPitch/PCM_RATE,1.0);
+	buffer[j] = 32768*curVol*oscSample(tone, phase);
+      }
+    }
+    sum += buffer[i%(PCM_RATE/25)];
+  }
+  keep = sum;
+  return BENCH_SAMPLES/elapsed(&t0);
+}
+
+static void benchWaves() {
+  int t;
+  double direct, table;
+
+  initWaves();
+  fprintf(tbl, "tone       switch S/s   table S/s    speedup\n");
+  for (t=0; t<NTONES; ++t) {
+    direct = renderRate(t, 0);
+    table = renderRate(t, 1);
+    fprintf(tbl, "%-10s %11.0lf  %11.0lf  %6.2lf\n",
+	    toneNames[t], direct, table, table/direct);
+    record("waves", "ns/sample", 1e9/direct, "%s switch", toneNames[t]);
+    record("waves", "ns/sample", 1e9/table, "%s table", toneNames[t]);
+  }
+}
+
+// block kernels against scalar table path: speed, and largest difference
+static void benchKernels() {
+  static int16_t fast[BLOCK], slow[BLOCK];
+  struct osc o1, o2;
+  struct timespec t0;
+  double pitchAdj, volAdj, tFast, tSlow, sq;
+  int t, b, i, d, worst, nBlocks = BENCH_SAMPLES/BLOCK;
+
+  fprintf(tbl, "tone       scalar S/s   kernel S/s   speedup  max err"
+	  "  rms err\n");
+  for (t=0; t<NTONES; ++t) {
+    // first check outputs agree, both starting each block in same state
+    o1.phase = 0; o1.pitch = 200; o1.vol = 0.2;
+    worst = 0;
+    sq = 0;
+    for (b=0; b<nBlocks; ++b) {
+      pitchAdj = (b%2 ? -1.0 : 1.3)/BLOCK; // glide up and down
+      volAdj = (b%3 ? 0.1 : -0.2)/nBlocks;
+      o2 = o1;
+      renderToneScalar(&o2, slow, BLOCK, t, pitchAdj, volAdj);
+      o2 = o1;
+      renderTone(&o1, fast, BLOCK, t, pitchAdj, volAdj);
+      for (i=0; i<BLOCK; ++i) {
+	d = abs(fast[i]-slow[i]);
+	if (d > worst) worst = d;
+	sq += (double)d*d;
+      }
+    }
+    // then time each path alone
+    o1.phase = 0; o1.pitch = 200; o1.vol = 0.2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (b=0; b<nBlocks; ++b)
+      renderToneScalar(&o1, slow, BLOCK, t, (b%2 ? -1.0 : 1.3)/BLOCK, 0);
+    tSlow = elapsed(&t0);
+    o1.phase = 0; o1.pitch = 200; o1.vol = 0.2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (b=0; b<nBlocks; ++b)
+      renderTone(&o1, fast, BLOCK, t, (b%2 ? -1.0 : 1.3)/BLOCK, 0);
+    tFast = elapsed(&t0);
+    keep = slow[1] + fast[1];
+    fprintf(tbl, "%-10s %11.0lf  %11.0lf  %6.2lf  %7d  %7.2lf\n",
+	    toneNames[t], nBlocks*BLOCK/tSlow, nBlocks*BLOCK/tFast,
+	    tSlow/tFast, worst, sqrt(sq/(nBlocks*BLOCK)));
+    record("synth", "ns/sample", 1e9*tSlow/(nBlocks*BLOCK), "%s scalar",
+	   toneNames[t]);
+    record("synth", "ns/sample", 1e9*tFast/(nBlocks*BLOCK), "%s",
+	   toneNames[t]);
+    record("synth", "max err", worst, "%s", toneNames[t]);
+  }
+}
+
+#endif
+
+// each effect alone then all together on a sine voice, turned right up;
+// fraction of a block's playing time says how many voices a board takes
+static void benchFx() {
+  static int16_t buffer[BLOCK];
+  static struct fx f;
+  struct osc o = {0};
+  struct timespec t0;
+  int amount[NFX], e, i, b, nBlocks = BENCH_SAMPLES/BLOCK;
+  double t;
+
+  initWaves();
+  fxInit();
+  if (!fxAlloc(&f))
+    return;
+  fprintf(tbl, "effect      ns/block  %% of block\n");
+  for (e=0; e<=NFX; ++e) {
+    for (i=0; i<NFX; ++i)
+      amount[i] = e == NFX || i == e ? FX_MAX : 0;
+    fxSet(&f, amount);
+    o.pitch = pitchOf(440);
+    o.vol = VOL_ONE/4;
+    t = 0;
+    for (b=0; b<nBlocks; ++b) {
+      renderTone(&o, buffer, BLOCK, SINE, 0, 0);
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      fxProcess(&f, buffer, BLOCK);
+      t += elapsed(&t0);
+    }
+    keep = buffer[1];
+    fprintf(tbl, "%-10s %9.0lf  %9.2lf\n", e < NFX ? fxNames[e] : "all",
+	    1e9*t/nBlocks, 100*t/nBlocks*PCM_RATE/BLOCK);
+    record("fx", "ns/block", 1e9*t/nBlocks, "%s",
+	   e < NFX ? fxNames[e] : "all");
+    for (i=0; i<NFX; ++i)
+      amount[i] = 0;
+    fxSet(&f, amount);
+  }
+}
+
+// what ALSA's plug layer does with 16-bit mono for a 48kHz stereo
+// device: linear resampling, then a conversion chosen per sample
+#define DEV_RATE 48000
+static volatile int plugFormat; // so it can't be folded away
+
+static int plugConvert(int16_t *src, int n, int32_t *dst) {
+  uint32_t pos = 0, step = ((uint64_t)PCM_RATE << 16)/DEV_RATE;
+  int m, s, i, c;
+
+  for (m=0; (i = pos >> 16) < n-1; ++m, pos += step) {
+    s = src[i] + (((src[i+1]-src[i])*(int32_t)(pos & 0xffff)) >> 16);
+    for (c=0; c<2; ++c)
+      switch (plugFormat) {
+      case PCM_S16: ((int16_t*)dst)[2*m+c] = s; break;
+      case PCM_S32: dst[2*m+c] = s << 16; break;
+      case PCM_S24: dst[2*m+c] = s << 8; break;
+      case PCM_FLOAT: ((float*)dst)[2*m+c] = s*(1.0f/32768);
+      }
+  }
+  return m;
+}
+
+// filling a stereo device block from the mixed one, by writer made for
+// its format against the plug path
+static void benchPcm() {
+  static int16_t buffer[BLOCK];
+  static int32_t out[2*BLOCK*DEV_RATE/PCM_RATE+2];
+  struct osc o = {0};
+  struct timespec t0;
+  pcmWriter *w;
+  int f, b, nBlocks = BENCH_SAMPLES/BLOCK;
+  double tNative, tPlug;
+
+  initWaves();
+  o.pitch = pitchOf(440);
+  o.vol = VOL_ONE/4;
+  renderTone(&o, buffer, BLOCK, SINE, 0, 0);
+  fprintf(tbl, "format     native ns  plug ns  speedup\n");
+  for (f=0; f<NPCM; ++f) {
+    w = findWriter(f, 2);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (b=0; b<nBlocks; ++b)
+      w(out, buffer, BLOCK, 2);
+    tNative = elapsed(&t0)/nBlocks;
+    keep = out[1];
+    plugFormat = f;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (b=0; b<nBlocks; ++b)
+      keep = plugConvert(buffer, BLOCK, out);
+    tPlug = elapsed(&t0)/nBlocks;
+    fprintf(tbl, "%-9s  %9.0lf  %7.0lf  %7.2lf\n", pcmNames[f],
+	    1e9*tNative, 1e9*tPlug, tPlug/tNative);
+    record("pcm", "ns/block", 1e9*tNative, "%s native", pcmNames[f]);
+    record("pcm", "ns/block", 1e9*tPlug, "%s plug", pcmNames[f]);
+  }
+}
+
+#define IF_MIN 3000
+#define IF_MAX 25000
+#define SPI_RATE 350 // clock divider, ~570kHz sampling as for pitch osc
+
+// decode as readOscs does, skipping jitter after each edge
+static int decode(unsigned char *bufr, int side, double freq, int useScan,
+		  int *found) {
+  static int posns[8*SPI_BUF];
+  int toChk = 0, current = bufr[0] >> 7, n = 0, j = 0, nPosns;
+
+  if (useScan) {
+    nPosns = scanTransitions(side, bufr, SPI_BUF, posns);
+    while (toChk = next_transition(posns, nPosns, SPI_BUF, &j, bufr[0] >> 7,
+				   toChk+1, current)) {
+      current = !current;
+      found[n++] = toChk;
+      toChk += FASTCLK*0.05/freq/SPI_RATE;
+    }
+  } else {
+    while (toChk = find_transition(side, bufr, SPI_BUF, toChk+1, current)) {
+      current = !current;
+      found[n++] = toChk;
+      toChk += FASTCLK*0.05/freq/SPI_RATE;
+    }
+  }
+  return n;
+}
+
+// cost of decoding one capture buffer per IF, word at a time vs one pass
+static void benchScan() {
+  static unsigned char bufr[SPI_BUF];
+  static int found1[8*SPI_BUF], found2[8*SPI_BUF];
+  struct timespec t0;
+  double freq, tWord, tScan, phase;
+  int side, i, n1, n2, reps = 2000, bad;
+
+  fprintf(tbl, "side  IF Hz   edges  word ns/buf  scan ns/buf  speedup"
+	  "  agree\n");
+  for (side=0; side<2; ++side)
+    for (freq=IF_MIN; freq<=IF_MAX; freq += (IF_MAX-IF_MIN)/4) {
+      phase = 0.3;
+      fakeBits(bufr, SPI_BUF, side, (double)FASTCLK/SPI_RATE, freq, &phase);
+      n1 = decode(bufr, side, freq, 0, found1);
+      n2 = decode(bufr, side, freq, 1, found2);
+      bad = n1 != n2;
+      for (i=0; i<n1 && !bad; ++i)
+	bad = found1[i] != found2[i];
+
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      for (i=0; i<reps; ++i)
+	keep = decode(bufr, side, freq, 0, found1);
+      tWord = elapsed(&t0);
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      for (i=0; i<reps; ++i)
+	keep = decode(bufr, side, freq, 1, found2);
+      tScan = elapsed(&t0);
+      fprintf(tbl, "%4d  %5.0lf  %6d  %11.0lf  %11.0lf  %6.2lf  %s\n",
+	      side, freq, n1, 1e9*tWord/reps, 1e9*tScan/reps, tWord/tScan,
+	      bad?"NO":"yes");
+      record("decode", "ns/buffer", 1e9*tWord/reps, "side %d %.0lfHz word",
+	     side, freq);
+      record("decode", "ns/buffer", 1e9*tScan/reps, "side %d %.0lfHz scan",
+	     side, freq);
+    }
+}
+
+// capture as readOscs used to: open, set up, transfer, close each time
+static void oldCapture(int side, unsigned char *bufr) {
+  struct spi_ioc_transfer spi;
+  uint32_t speed = FASTCLK/SPI_RATE;
+  uint8_t mode = 0, bpw = 8;
+  int fd;
+
+  fd = spiOps->open(side ? "/dev/spidev1.0" : "/dev/spidev0.0", O_RDWR);
+  spiOps->ioctl(fd, SPI_IOC_WR_MODE, &mode);
+  spiOps->ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bpw);
+  spiOps->ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+  memset(&spi, 0, sizeof(spi));
+  spi.tx_buf = spi.rx_buf = (unsigned long)bufr;
+  spi.len = SPI_BUF;
+  spi.speed_hz = speed;
+  spi.bits_per_word = bpw;
+  spiOps->ioctl(fd, SPI_IOC_MESSAGE(1), &spi);
+  spiOps->close(fd);
+  spiCalls += 6;
+}
+
+// buffers captured and decoded per second and syscalls per buffer,
+// on fake spidev taking real bus time
+static void benchCapture() {
+  static unsigned char bufr[SPI_BUF];
+  static int posns[8*SPI_BUF];
+  static volatile int rate = SPI_RATE, len = SPI_BUF;
+  struct timespec t0, stamp;
+  unsigned long calls;
+  double t;
+  int n, r, l;
+
+  spiOps = &fakeSpi;
+  fakeBusTime = 1;
+  fakeIF[0] = 10000;
+
+  fprintf(tbl, "capture     bufs/s  syscalls/buf\n");
+  calls = spiCalls;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (n=0; (t = elapsed(&t0)) < 1; ++n) {
+    oldCapture(0, bufr);
+    keep = scanTransitions(0, bufr, SPI_BUF, posns);
+  }
+  fprintf(tbl, "per-buffer  %6.1lf  %6.2lf\n", n/t,
+	  (double)(spiCalls-calls)/n);
+  record("capture", "ns/buffer", 1e9*t/n, "per-buffer");
+
+  spiStart(0, &rate, &len);
+  spiDone(0); // throw away first, it includes setup
+  spiNext(0, &stamp, &r, &l);
+  calls = spiCalls;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (n=0; (t = elapsed(&t0)) < 1; ++n) {
+    keep = scanTransitions(0, spiNext(0, &stamp, &r, &l), l, posns);
+    spiDone(0);
+  }
+  fprintf(tbl, "pipelined   %6.1lf  %6.2lf\n", n/t,
+	  (double)(spiCalls-calls)/n);
+  fprintf(tbl, "bus time alone %.1lf bufs/s\n",
+	  FASTCLK/SPI_RATE/(8.0*SPI_BUF));
+  record("capture", "ns/buffer", 1e9*t/n, "pipelined");
+}
+
+// pitch side of readOscs on one capture of len bytes, estimate after it
+static double readCapture(struct est *e, unsigned char *bufr, int len) {
+  static int posns[8*SPI_BUF];
+  int toChk = 0, current = bufr[0] >> 7, n, j = 0, last[2] = {0, 0};
+
+  estBreak(e);
+  n = scanTransitions(0, bufr, len, posns);
+  while (toChk = next_transition(posns, n, len, &j, bufr[0] >> 7,
+				 toChk+1, current)) {
+    current = !current;
+    if (last[current])
+      estUpdate(e, (double)SPI_RATE*(toChk - last[current])/FASTCLK,
+		(double)SPI_RATE*(toChk - last[!current])/FASTCLK);
+    last[current] = toChk;
+    toChk += FASTCLK*0.05/e->freq/SPI_RATE;
+  }
+  return e->freq;
+}
+
+// readings per second of bus time against their error, capture sized by
+// IF cycles wanted as uts does, or always a whole buffer
+static void benchAdapt() {
+  static unsigned char bufr[SPI_BUF];
+  static const int wanted[] = {8, 16, 24, 48, 0};
+  struct est e;
+  double freq, phase, err, sum, worst;
+  int w, i, len, settle = 200, n = 1000;
+  char label[8];
+
+  fprintf(tbl, "IF Hz  cycles  bytes  readings/s  rms cents  max cents\n");
+  for (freq=IF_MIN; freq<=IF_MAX; freq += (IF_MAX-IF_MIN)/4)
+    for (w=0; w<sizeof(wanted)/sizeof(*wanted); ++w) {
+      len = wanted[w] ? spiLen(freq, SPI_RATE, wanted[w]) : SPI_BUF;
+      estInit(&e, freq*1.02);
+      phase = 0.3;
+      sum = worst = 0;
+      srand(1);
+      for (i=0; i<settle+n; ++i) {
+	fakeBits(bufr, len, 0, (double)FASTCLK/SPI_RATE, freq, &phase);
+	phase = fmod(phase + 0.37, 1.0); // gap while decoding
+	err = 1200*log2(readCapture(&e, bufr, len)/freq);
+	if (i < settle)
+	  continue;
+	sum += err*err;
+	if (fabs(err) > worst) worst = fabs(err);
+      }
+      if (wanted[w])
+	snprintf(label, sizeof(label), "%d", wanted[w]);
+      else
+	strcpy(label, "whole");
+      fprintf(tbl, "%5.0lf  %6s  %5d  %10.0lf  %9.3lf  %9.3lf\n", freq,
+	      label, len, FASTCLK/SPI_RATE/(8.0*len), sqrt(sum/n), worst);
+      record("adapt", "readings/s", FASTCLK/SPI_RATE/(8.0*len),
+	     "%.0lfHz %d cycles", freq, wanted[w]);
+      record("adapt", "rms cents", sqrt(sum/n), "%.0lfHz %d cycles",
+	     freq, wanted[w]);
+    }
+}
+
+#ifdef FIXED // tables are Q16, so notes can be off by a 1e-5 or so
+#define QUANTIZE(mode, tgt) \
+  (quantize(mode, (tgt)*(TUNE_ONE/4096))/(double)(TUNE_ONE/4096))
+#define SAME_NOTE 1e-4
+#else
+#define QUANTIZE(mode, tgt) quantize(mode, tgt)
+#define SAME_NOTE 1e-6
+#endif
+
+// autotune by table against working it out, over a pitch sweep
+static void benchTune() {
+  struct timespec t0;
+  double tgt, tSlow, tFast, sum;
+  int mode, i, same, n = 1000000;
+
+  initScales();
+  fprintf(tbl, "autotune    slow ns  table ns  speedup  same note\n");
+  for (mode=CHROMATIC; mode<AEOLIAN; ++mode) {
+    for (i=same=0; i<n; ++i) {
+      tgt = 1000*exp2(5.0*i/n); // 5 octaves up from ~60Hz
+      same += fabs(QUANTIZE(mode, tgt)/quantizeSlow(mode, tgt) - 1)
+	< SAME_NOTE;
+    }
+    sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i=0; i<n; ++i)
+      sum += quantizeSlow(mode, 1000 + i*0.031);
+    tSlow = elapsed(&t0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i=0; i<n; ++i)
+      sum += QUANTIZE(mode, 1000 + i*0.031);
+    tFast = elapsed(&t0);
+    keep = sum;
+    fprintf(tbl, "%-10s %8.1lf %9.1lf  %6.2lf  %8.3lf%%\n",
+	    scales[mode].name, 1e9*tSlow/n, 1e9*tFast/n, tSlow/tFast,
+	    100.0*same/n);
+    record("autotune", "ns/note", 1e9*tSlow/n, "%s slow", scales[mode].name);
+    record("autotune", "ns/note", 1e9*tFast/n, "%s", scales[mode].name);
+  }
+}
+
+// made-up IF as hand moves: still, fast gesture, still, slow glide
+#define EST_SECS 1.5
+static double gesture(double t, double *slope) {
+  *slope = 0;
+  if (t < 0.3) return 8000;
+  if (t < 0.35) return 8000 + (*slope = 80000)*(t-0.3);
+  if (t < 0.65) return 12000;
+  if (t < 1.15) return 12000 + (*slope = -8000)*(t-0.65);
+  return 8000;
+}
+
+static double gauss() { // Box-Muller
+  double u = (rand()+1.0)/(RAND_MAX+2.0), v = (rand()+1.0)/(RAND_MAX+2.0);
+
+  return sqrt(-2*log(u))*cos(2*M_PI*v);
+}
+
+// edges from gesture with jitter and 1us ticks, as mts decodes them;
+// steady error in Hz, lag in ms while moving, settling after fast move
+static void benchEst() {
+  struct est e;
+  double t, tick, phase, f, slope, sigma, err, sq, fastLag, slowLag, settle;
+  double last[2], prev, sigmas[] = {0, 1e-6, 3e-6};
+  int kind, k, edge, nSq, nFast, nSlow;
+
+  fprintf(tbl, "estimator  jitter us  still rms Hz  fast lag ms  slow lag ms"
+	 "  settle ms\n");
+  for (k=0; k<3; ++k)
+    for (kind=0; kind<NESTS; ++kind) {
+      sigma = sigmas[k];
+      srand(1);
+      estKind = kind;
+      estInit(&e, 8000);
+      t = phase = 0;
+      last[0] = last[1] = prev = -1;
+      sq = fastLag = slowLag = 0;
+      nSq = nFast = nSlow = 0;
+      settle = 0.35;
+      for (edge=0; t<EST_SECS; edge = !edge) {
+	// next half cycle, small steps so frequency can change within it
+	for (; phase < 0.5; t += 1e-6)
+	  phase += gesture(t, &slope)*1e-6;
+	phase -= 0.5;
+	tick = floor((t + sigma*gauss())*1e6)*1e-6;
+	if (last[edge] >= 0 && prev >= 0)
+	  estUpdate(&e, tick-last[edge], tick-prev);
+	last[edge] = prev = tick;
+
+	f = gesture(t, &slope);
+	err = f - e.freq;
+	if ((t > 0.15 && t < 0.3) || (t > 0.5 && t < 0.65)) {
+	  sq += err*err;
+	  ++nSq;
+	} else if (slope > 10000) {
+	  fastLag += err/slope;
+	  ++nFast;
+	} else if (slope) {
+	  slowLag += err/slope;
+	  ++nSlow;
+	}
+	if (t > 0.35 && t < 0.65 && fabs(err) > 0.01*f)
+	  settle = t;
+      }
+      fprintf(tbl, "%-10s %9.0lf  %12.1lf  %11.1lf  %11.1lf  %9.1lf\n",
+	      estNames[kind], sigma*1e6, sqrt(sq/nSq), 1e3*fastLag/nFast,
+	      1e3*slowLag/nSlow, 1e3*(settle-0.35));
+      record("estimator", "still rms Hz", sqrt(sq/nSq), "%s %.0lfus",
+	     estNames[kind], sigma*1e6);
+      record("estimator", "fast lag ms", 1e3*fastLag/nFast, "%s %.0lfus",
+	     estNames[kind], sigma*1e6);
+    }
+}
+
+// edges as pigpio reports them from two IFs with 1us jitter, queued by
+// logTrans and drained a millisecond's worth at a time as mts does
+#define EDGE_SECS 1
+static int makeEdges(struct edge *made, double freqs[2]) {
+  double t[2] = {0, 0};
+  int n = 0, s, level[2] = {0, 0};
+
+  srand(1);
+  while (t[0] < EDGE_SECS || t[1] < EDGE_SECS) {
+    s = t[1] < t[0]; // whichever pin is due first
+    made[n].pin = s;
+    made[n].edge = level[s] = !level[s];
+    made[n++].tick = floor((t[s] + 1e-6*gauss())*1e6);
+    t[s] += 0.5/freqs[s];
+  }
+  return n;
+}
+
+static void benchEdges() {
+  static struct edge made[4*EDGE_SECS*IF_MAX];
+  struct edgeTiming timings[2];
+  struct est ests[2];
+  struct timespec t0;
+  double freqs[2] = {8000, 12000}, tLog, tDecode;
+  unsigned int head, tail;
+  int kind, n, i, j, rep, reps = 20, s;
+  struct edge *e;
+
+  n = makeEdges(made, freqs);
+  fprintf(tbl, "estimator  logTrans ns/edge  decode ns/edge  err Hz\n");
+  for (kind=0; kind<NESTS; ++kind) {
+    estKind = kind;
+    tLog = tDecode = 0;
+    for (rep=0; rep<reps; ++rep) {
+      memset(timings, 0, sizeof(timings));
+      estInit(ests, freqs[0]);
+      estInit(ests+1, freqs[1]);
+      for (i=0; i<n; i=j) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (j=i; j<n && made[j].tick/1000 == made[i].tick/1000; ++j)
+	  logTrans(made[j].pin, made[j].edge, made[j].tick);
+	tLog += elapsed(&t0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	tail = atomic_load_explicit(&edgeTail, memory_order_relaxed);
+	head = atomic_load_explicit(&edgeHead, memory_order_acquire);
+	for (; tail != head; ++tail) {
+	  e = edges + tail%EDGE_RING;
+	  s = e->pin;
+	  decodeEdge(ests+s, timings+s, IF_MAX, e->edge, e->tick);
+	}
+	atomic_store_explicit(&edgeTail, tail, memory_order_release);
+	tDecode += elapsed(&t0);
+      }
+    }
+    fprintf(tbl, "%-10s %17.1lf  %14.1lf  %6.1lf\n", estNames[kind],
+	    1e9*tLog/(reps*n), 1e9*tDecode/(reps*n),
+	    fabs(ests[0].freq - freqs[0]) + fabs(ests[1].freq - freqs[1]));
+    record("edges", "ns/edge", 1e9*tLog/(reps*n), "logTrans %s",
+	   estNames[kind]);
+    record("edges", "ns/edge", 1e9*tDecode/(reps*n), "decode %s",
+	   estNames[kind]);
+  }
+}
+
+// loopback receiver for the controller stream: counts readings and,
+// for OSC, how long after sensing each one arrived
+static struct receiver {
+  int fd, osc;
+  volatile long got;
+  volatile double latSum, latMax;
+} oscRx = {-1, 1}, midiRx = {-1, 0};
+
+static uint32_t get32(unsigned char *p) {
+  return (uint32_t)p[0]<<24 | p[1]<<16 | p[2]<<8 | p[3];
+}
+
+static void oscArrived(struct receiver *rx, unsigned char *msg,
+		       struct timespec *now) {
+  double lat = now->tv_sec - get32(msg+32) +
+    1e-9*now->tv_nsec - get32(msg+36)/4294967296.0; // sensed timetag
+
+  rx->latSum += lat;
+  if (lat > rx->latMax) rx->latMax = lat;
+  ++rx->got;
+}
+
+static void* rxLoop(void* arg) {
+  struct receiver *rx = arg;
+  unsigned char buf[4096], *p;
+  struct timespec now;
+  int len, i;
+
+  for (;;) {
+    if ((len = read(rx->fd, buf, sizeof(buf))) <= 0)
+      continue;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    if (!rx->osc) { // a pitch bend for each reading, as pitch never rests
+      for (i=0; i<len; ++i)
+	rx->got += (buf[i]&0xf0) == 0xe0;
+    } else if (memcmp(buf, "#bundle", 8))
+      oscArrived(rx, buf, &now);
+    else
+      for (p=buf+16; p<buf+len; p += 4+get32(p))
+	oscArrived(rx, p+4, &now);
+  }
+  return NULL;
+}
+
+// two instruments each updated at 2kHz for a second, as fast as mts can
+static void streamRun(struct receiver *rx, char *spec, int batch,
+		      double rate) {
+  struct timespec t0, next, sensed;
+  long sent0 = stats->streamSent, drop0 = stats->streamDropped, n;
+  double t;
+
+  streamBatch = batch;
+  streamRate = rate;
+  if (!openStream(spec))
+    exit(EXIT_FAILURE);
+  rx->got = 0;
+  rx->latSum = rx->latMax = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  next = t0;
+  for (n=0; (t = elapsed(&t0)) < 1; ++n) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &sensed);
+    streamCtl(n%2, pitchOf(300 + 200*sin(n*0.01)), VOL_ONE/2, &sensed);
+    if ((next.tv_nsec += 250000) >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      ++next.tv_sec;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  next.tv_sec = 0;
+  next.tv_nsec = 50000000; // let the last arrive
+  nanosleep(&next, NULL);
+  fprintf(tbl, "%-4s %5d %6.0lf %8.0lf %8.0lf %7ld ",
+	  rx->osc ? "osc" : "midi", batch, rate, n/t, rx->got/t,
+	  stats->streamDropped - drop0);
+  record("stream", "readings/s", rx->got/t, "%s batch %d rate %.0lf",
+	 rx->osc ? "osc" : "midi", batch, rate);
+  if (rx->osc && rx->got) {
+    fprintf(tbl, "%8.0lf %8.0lf\n", 1e6*rx->latSum/rx->got,
+	    1e6*rx->latMax);
+    record("stream", "mean latency us", 1e6*rx->latSum/rx->got,
+	   "osc batch %d rate %.0lf", batch, rate);
+  } else
+    fprintf(tbl, "%8s %8s\n", "-", "-");
+  keep = stats->streamSent - sent0;
+}
+
+// controller stream to a receiver in this process, over UDP and a pipe
+static void benchStream() {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  pthread_t threadId;
+  char spec[64];
+  int pfd[2];
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((oscRx.fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+      bind(oscRx.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      getsockname(oscRx.fd, (struct sockaddr*)&addr, &len) < 0 ||
+      pipe(pfd) < 0) {
+    perror("stream loopback");
+    return;
+  }
+  midiRx.fd = pfd[0];
+  pthread_create(&threadId, NULL, rxLoop, &oscRx);
+  pthread_create(&threadId, NULL, rxLoop, &midiRx);
+
+  fprintf(tbl, "out  batch   rate  sent/s   recv/s  dropped  mean us"
+	  "   max us\n");
+  snprintf(spec, sizeof(spec), "osc:127.0.0.1:%d", ntohs(addr.sin_port));
+  streamRun(&oscRx, spec, 1, 0);
+  streamRun(&oscRx, spec, 8, 0);
+  streamRun(&oscRx, spec, 1, 250);
+  snprintf(spec, sizeof(spec), "midi:/dev/fd/%d", pfd[1]);
+  streamRun(&midiRx, spec, 1, 0);
+  streamRun(&midiRx, spec, 8, 250);
+}
+
+// sensor thread publishing at uneven intervals around 1ms, as a capture
+static atomic_int sensing;
+
+static void* sensorLoop(void* arg) {
+  struct timespec tv, stamps[2];
+  double ifs[2] = {5000, 4000};
+
+  tv.tv_sec = 0;
+  while (atomic_load(&sensing)) {
+    tv.tv_nsec = 200000 + rand()%1000000;
+    nanosleep(&tv, NULL);
+    clock_gettime(CLOCK_MONOTONIC_RAW, stamps);
+    stamps[1] = stamps[0];
+    snapPublish(0, 3, ifs, stamps);
+  }
+  return NULL;
+}
+
+// time from reading published to control loop acting on it, for a second
+static void wakeRun(int event) {
+  struct timespec t0, tv, now;
+  struct ifSnap snap;
+  pthread_t threadId;
+  unsigned int seen, events;
+  long loops = 0, got = 0, missed = 0;
+  int fresh;
+  double lat, latSum = 0, latMax = 0;
+
+  getSnap(0, &snap);
+  seen = snap.version;
+  atomic_store(&sensing, 1);
+  pthread_create(&threadId, NULL, sensorLoop, NULL);
+  tv.tv_sec = 0;
+  tv.tv_nsec = 2000000;
+  events = snapEvents();
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  while (elapsed(&t0) < 1) {
+    ++loops;
+    getSnap(0, &snap);
+    if ((fresh = snap.version != seen)) {
+      clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+      lat = now.tv_sec - snap.stamp.tv_sec +
+	1e-9*(now.tv_nsec - snap.stamp.tv_nsec);
+      latSum += lat;
+      if (lat > latMax) latMax = lat;
+      missed += snap.version - seen - 1; // overwritten before we looked
+      seen = snap.version;
+      ++got;
+    }
+    if (event)
+      events = snapWait(events, 100000000);
+    else if (!fresh) // as mtp did
+      nanosleep(&tv, NULL);
+  }
+  atomic_store(&sensing, 0);
+  pthread_join(threadId, NULL);
+  fprintf(tbl, "%-6s %8ld %8ld %8.2lf %8.0lf %8.0lf\n",
+	  event ? "futex" : "2ms", got, missed, (double)loops/got,
+	  1e6*latSum/got, 1e6*latMax);
+  record("wake", "mean latency us", 1e6*latSum/got, event ? "futex" : "poll");
+  record("wake", "max latency us", 1e6*latMax, event ? "futex" : "poll");
+  record("wake", "missed", missed, event ? "futex" : "poll");
+}
+
+// control loop waking for sensor readings: old poll against futex
+static void benchWake() {
+  fprintf(tbl, "wake       used   missed  loops/r  mean us   max us\n");
+  wakeRun(0);
+  wakeRun(1);
+}
+
+// cost of a trace point when built in, one thread and two at once;
+// without -DTRACE they are not in the code at all
+static void* traceLoop(void* arg) {
+  int i, n = *(int*)arg;
+
+  traceThread("bench");
+  for (i=0; i<n; ++i) {
+    traceEvent("bench", 'B');
+    traceEvent("bench", 'E');
+  }
+  return NULL;
+}
+
+static void benchTrace() {
+  pthread_t threadId;
+  struct timespec t0;
+  int n = 1000000;
+  double t1, t2;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  traceLoop(&n);
+  t1 = elapsed(&t0)/(2*n);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pthread_create(&threadId, NULL, traceLoop, &n);
+  traceLoop(&n);
+  pthread_join(threadId, NULL);
+  t2 = elapsed(&t0)/(4*n);
+  fprintf(tbl, "trace event %.1lf ns, %.1lf ns with two threads\n",
+	  1e9*t1, 1e9*t2);
+  record("trace", "ns/event", 1e9*t1, "one thread");
+  record("trace", "ns/event", 1e9*t2, "two threads");
+}
+
+int main(int argc, char* argv[]) {
+  tbl = stdout;
+  uname(&host);
+  if (argc > 1 && !strcmp(argv[1], "-c")) { // machine-readable
+    csv = 1;
+    tbl = stderr;
+    printf("machine,build,bench,case,metric,value\n");
+  }
+#ifdef FIXED
+  benchFixed();
+  benchFixMath();
+#else
+  benchWaves();
+  benchKernels();
+#endif
+  benchFx();
+  benchPcm();
+  benchScan();
+  benchCapture();
+  benchAdapt();
+  benchTune();
+  benchEst();
+  benchEdges();
+  benchStream();
+  benchWake();
+  benchTrace();
+  return 0;
+}
@@ -0,0 +1,180 @@
+// finding the antenna oscillators, shared by sensing backends
+// copyright simulistics ltd
+// clocks sit IF_MIN above each oscillator, so the IF rises as a hand
+// pulls the oscillator down; last clocks are cached so a warm start
+// only has to check them, else both antennas are searched together
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "calib.h"
+
+// search stages for each antenna
+#define SWEEP		0 // stepping till a beat shows up
+#define ABOVE		1 // trying oscillator above clock beat was seen at
+#define BELOW		2 // and below
+#define FOUND		3
+#define MISSING		4 // swept the lot, left at the guess
+
+int calibCold = 0;
+
+static void measure(struct calibOps *ops, double ifs[2]) {
+  struct timespec tv;
+
+  tv.tv_sec = ops->settleNs/1000000000;
+  tv.tv_nsec = ops->settleNs%1000000000;
+  ops->restart();
+  nanosleep(&tv, NULL);
+  ops->read(ifs);
+}
+
+// near enough quiescent IF to keep, a drifted clock is re-centred
+static int quiescent(struct calibOps *ops, double freq) {
+  return freq > ops->ifMin/2 && freq < 2*ops->ifMin;
+}
+
+static int loadClocks(struct calibOps *ops, int clocks[2]) {
+  char fileName[64];
+  FILE *stm;
+  int got;
+
+  snprintf(fileName, sizeof(fileName), CALIB_FILE, ops->name);
+  if (calibCold || !(stm = fopen(fileName, "r")))
+    return 0;
+  got = fscanf(stm, "%d %d", clocks, clocks+1);
+  fclose(stm);
+  return got == 2;
+}
+
+// may run as root in a world-writable directory, so never via a link
+static void saveClocks(struct calibOps *ops, int clocks[2]) {
+  char fileName[64];
+  FILE *stm;
+  int fd;
+
+  snprintf(fileName, sizeof(fileName), CALIB_FILE, ops->name);
+  if ((fd = open(fileName, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW, 0644)) < 0
+      || !(stm = fdopen(fd, "w"))) {
+    perror(fileName);
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  fprintf(stm, "%d %d\n", clocks[0], clocks[1]);
+  fclose(stm);
+}
+
+// sweep in steps of the useful IF range so one reading lands in it;
+// a beat seen at clock b could be from an oscillator at b+f or b-f,
+// so set the clock for each in turn and see which gives IF_MIN
+static void search(struct calibOps *ops, int guess[2], int stage[2],
+		   int clocks[2]) {
+  int s, b[2], seenAt[2], top[2], step = ops->ifMax - ops->ifMin;
+  double ifs[2], seen[2];
+
+  for (s=0; s<2; ++s) {
+    if (stage[s] != FOUND) // else clock from cache stands
+      clocks[s] = guess[s] - ops->uncertainty;
+    top[s] = guess[s] + ops->uncertainty;
+  }
+  while (stage[0] < FOUND || stage[1] < FOUND) {
+    for (s=0; s<2; ++s)
+      if (stage[s] < FOUND)
+	b[s] = ops->setClock(s, clocks[s]);
+    measure(ops, ifs);
+    for (s=0; s<2; ++s) {
+      if (stage[s] >= FOUND)
+	continue;
+      fprintf(stderr, "%d: hit %.0lf with %d\n", s, ifs[s], b[s]);
+      switch (stage[s]) {
+      case SWEEP:
+	if (ifs[s] >= ops->ifMin && ifs[s] < ops->ifMax) { // a valid reading
+	  seen[s] = ifs[s];
+	  seenAt[s] = b[s];
+	  clocks[s] = b[s] + seen[s] + ops->ifMin;
+	  stage[s] = ABOVE;
+	} else if ((clocks[s] += step) > top[s]) {
+	  fprintf(stderr, "%d: no oscillator near %d\n", s, guess[s]);
+	  clocks[s] = guess[s];
+	  stage[s] = MISSING;
+	}
+	continue;
+      case ABOVE:
+	if (!quiescent(ops, ifs[s])) {
+	  clocks[s] = seenAt[s] - seen[s] + ops->ifMin;
+	  stage[s] = BELOW;
+	  continue;
+	}
+	break;
+      case BELOW:
+	if (!quiescent(ops, ifs[s])) { // neither, carry on sweeping
+	  clocks[s] = seenAt[s] + step;
+	  stage[s] = SWEEP;
+	  continue;
+	}
+	break;
+      }
+      clocks[s] = b[s] - ifs[s] + ops->ifMin; // exactly IF_MIN above
+      stage[s] = FOUND;
+    }
+  }
+}
+
+// set clocks for both antennas, from cache if they still fit;
+// a drifted clock is re-centred and checked again, as the IF alone
+// can't tell an oscillator a little below the clock from one above it;
+// a side with no oscillator found keeps what was cached, 0 if nothing
+void calibrate(struct calibOps *ops, int guess[2], int clocks[2]) {
+  struct timespec t0, t1;
+  double ifs[2];
+  int s, b[2], moved[2] = {0, 0}, stage[2] = {SWEEP, SWEEP};
+  int cached[2] = {0, 0};
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (loadClocks(ops, cached) && (cached[0] > 0 || cached[1] > 0)) {
+    for (s=0; s<2; ++s)
+      if (cached[s] > 0)
+	b[s] = ops->setClock(s, clocks[s] = cached[s]);
+    measure(ops, ifs);
+    for (s=0; s<2; ++s) {
+      if (cached[s] <= 0)
+	continue;
+      guess[s] = clocks[s] - ops->ifMin;
+      if (!quiescent(ops, ifs[s]))
+	fprintf(stderr, "%d: cached clock %d gave IF %.0lf, searching\n",
+		s, clocks[s], ifs[s]);
+      else {
+	stage[s] = FOUND;
+	if (fabs(ifs[s] - ops->ifMin) > ops->ifMin/8) { // follow drift
+	  clocks[s] = b[s] - ifs[s] + ops->ifMin;
+	  b[s] = ops->setClock(s, clocks[s]);
+	  moved[s] = 1;
+	}
+      }
+    }
+    if (moved[0] || moved[1]) {
+      measure(ops, ifs);
+      for (s=0; s<2; ++s)
+	if (moved[s] && fabs(ifs[s] - ops->ifMin) > ops->ifMin/4) {
+	  fprintf(stderr, "%d: clock %d drifted too far, searching\n",
+		  s, clocks[s]);
+	  stage[s] = SWEEP;
+	}
+    }
+  }
+  if (stage[0] != FOUND || stage[1] != FOUND)
+    search(ops, guess, stage, clocks);
+  for (s=0; s<2; ++s) {
+    clocks[s] = ops->setClock(s, clocks[s]);
+    if (stage[s] != MISSING)
+      cached[s] = clocks[s];
+  }
+  saveClocks(ops, cached);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  fprintf(stderr, "Clocks %d %d, calibrated in %.2lfs\n", clocks[0], clocks[1],
+	  (t1.tv_sec-t0.tv_sec) + 1e-9*(t1.tv_nsec-t0.tv_nsec));
+}
@@ -0,0 +1,17 @@
+// finding the antenna oscillators, shared by sensing backends
+// copyright simulistics ltd
+
+#define CALIB_FILE	"/var/tmp/%s.cal" // last clocks found, by backend
+
+struct calibOps { // what a backend provides
+  char *name; // of cache file
+  int ifMin, ifMax, uncertainty; // Hz
+  long settleNs; // from setting clocks to IFs being readable
+  int (*setClock)(int s, int freq); // returns clock actually set
+  void (*restart)(); // estimates start again after clocks change
+  void (*read)(double ifs[2]); // IFs of both antennas
+};
+
+extern int calibCold; // ignore cached clocks
+
+void calibrate(struct calibOps *ops, int guess[2], int clocks[2]);
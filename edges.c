@@ -0,0 +1,58 @@
+// GPIO edges from pigpio's alert thread, decoded by our own
+// copyright simulistics ltd
+// no pigpio calls here, so it can be timed without the hardware
+
+#include <stdint.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+#include "est.h"
+#include "edges.h"
+#include "trace.h"
+
+struct edge edges[EDGE_RING];
+atomic_uint edgeHead, edgeTail, edgesLost;
+
+// alert callback: just queue the edge, keep it short so none are missed
+void logTrans(int pin, int edge, unsigned int actTime) {
+  unsigned int head = atomic_load_explicit(&edgeHead, memory_order_relaxed);
+
+  TRACE_EDGE("edge");
+  if (head - atomic_load_explicit(&edgeTail, memory_order_acquire)
+      == EDGE_RING) {
+    atomic_fetch_add_explicit(&edgesLost, 1, memory_order_relaxed);
+    return;
+  }
+  edges[head%EDGE_RING].pin = pin;
+  edges[head%EDGE_RING].edge = edge;
+  edges[head%EDGE_RING].tick = actTime;
+  atomic_store_explicit(&edgeHead, head+1, memory_order_release);
+}
+
+// update frequency estimate for one edge of a pin, returns 1 if it counted
+int decodeEdge(struct est *est, struct edgeTiming *timing, int ifMax,
+	       int edge, unsigned int actTime) {
+  int lastPeriod, sinceLast;
+
+  if (timing->lastUp == timing->lastDown) // first go, set up context
+    timing->lastUp = timing->lastDown = actTime - 1e6/ifMax;
+  
+  sinceLast = actTime - (edge==EDGE_RISING?timing->lastDown:timing->lastUp);
+  if (edge==timing->lastEdge || // old debounce clock jitter
+      sinceLast < 0.1e6/est->freq)
+    return 0;
+
+  timing->lastEdge = edge;
+  if (edge == EDGE_RISING) {
+    lastPeriod = actTime - timing->lastUp;
+    timing->lastUp = actTime;
+  } else {
+    lastPeriod = actTime - timing->lastDown;
+    timing->lastDown = actTime;
+  }
+
+  estUpdate(est, 1e-6*lastPeriod, 1e-6*sinceLast);
+// debounce clock jitter v2
+//  gpioGlitchFilter(pin, (int)(0.05e6/(IF_MIN>*freq?IF_MIN:*freq)));
+  return 1;
+}
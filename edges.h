@@ -0,0 +1,25 @@
+// GPIO edges from pigpio's alert thread, decoded by our own
+// copyright simulistics ltd
+
+// needs stdint.h, stdatomic.h and est.h
+
+#define EDGE_RING	8192 // power of 2, ~80ms of both pins at IF_MAX
+#define EDGE_RISING	1 // as pigpio's RISING_EDGE
+
+struct edge {
+  uint8_t pin, edge;
+  uint32_t tick;
+};
+
+struct edgeTiming { // decoder's memory of one pin
+  int lastEdge;
+  unsigned int lastUp, lastDown;
+};
+
+// single producer (alert callback), single consumer (decoder)
+extern struct edge edges[EDGE_RING];
+extern atomic_uint edgeHead, edgeTail, edgesLost;
+
+void logTrans(int pin, int edge, unsigned int actTime);
+int decodeEdge(struct est *est, struct edgeTiming *timing, int ifMax,
+	       int edge, unsigned int actTime);
@@ -0,0 +1,103 @@
+// IF frequency estimation from edge timings, shared by sensing backends
+// copyright simulistics ltd
+// the smoother weights every period alike, so it lags a moving hand by
+// TIMECONST/2; the tracker also follows the rate of change, and widens
+// its gain when periods stray further than the noise can explain
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "est.h"
+
+#define TRACK_SLOW	(TIMECONST/2) // gain time constant when hand is still
+#define TRACK_FAST	0.002 // and when it is moving
+#define NOISE_TC	0.2 // for learning the jitter
+#define NOISE_MIN	0.5e-6 // half a pigpio tick
+#define DRIFT_TC	0.002 // for telling a steady drift from jitter
+#define Z_LO		3 // drift/expected where gain starts to widen
+#define Z_HI		6 // and where it is fully open
+
+char *estNames[NESTS] = {"smooth", "track"};
+int estKind = TRACK;
+
+int findEst(char *name) {
+  int i;
+
+  for (i=0; i<NESTS; ++i)
+    if (!strcmp(name, estNames[i]))
+      return i;
+  return -1;
+}
+
+void estInit(struct est *e, double freq) {
+  e->kind = estKind;
+  e->freq = freq;
+  e->period = 1/freq;
+  e->now = 0;
+  e->which = e->primed = e->measured = 0;
+  e->noise = 0.01*e->period;
+  e->drift = 0;
+}
+
+// next edges can't be timed from the last ones, period still holds
+void estBreak(struct est *e) {
+  e->primed = 0;
+}
+
+static double smooth(struct est *e, double period) {
+  if (period > TIMECONST)
+    e->freq = 1/period;
+  else
+    e->freq = (1-period/TIMECONST)*e->freq + 1/TIMECONST;
+  return e->freq;
+}
+
+// edges alternate rising and falling, each kind is predicted one
+// period on from the last; jitter on an edge time then only counts once,
+// as it does for the smoother, rather than twice as a period would
+static double track(struct est *e, double period, double dt) {
+  double pred, r, z, a, b, w;
+  int i;
+
+  if (period > TIMECONST) { // too slow to track, take as it is
+    estInit(e, 1/period);
+    return e->freq;
+  }
+  e->now += dt;
+  i = e->which = !e->which;
+  if (!(e->primed & 1<<i)) { // first of its kind
+    e->primed |= 1<<i;
+    e->edges[i] = e->now;
+    if (!e->measured) { // better than whatever estInit was told
+      e->measured = 1;
+      e->period = period;
+      e->freq = 1/period;
+    }
+    return e->freq;
+  }
+  pred = e->edges[i] + e->period;
+  r = e->now - pred;
+  // errors from jitter cancel out, from a moving hand they don't
+  e->drift += (r - e->drift)*dt/DRIFT_TC;
+  z = fabs(e->drift)/e->noise*sqrt(2*DRIFT_TC/dt);
+  w = (z-Z_LO)/(Z_HI-Z_LO);
+  w = w < 0 ? 0 : w > 1 ? 1 : w;
+  a = dt/TRACK_SLOW + w*dt/TRACK_FAST;
+  if (a > 1) a = 1;
+  b = a*a/(2-a); // critically damped
+  e->edges[i] = pred + a*r;
+  e->period += b*r;
+  if (z < Z_LO) // learn jitter only while hand is still
+    e->noise += (fabs(r) - e->noise)*dt/NOISE_TC;
+  if (e->noise < NOISE_MIN)
+    e->noise = NOISE_MIN;
+  e->freq = 1/e->period;
+  return e->freq;
+}
+
+double estUpdate(struct est *e, double period, double dt) {
+  if (period <= 0 || dt <= 0)
+    return e->freq;
+  return e->kind == TRACK ? track(e, period, dt) : smooth(e, period);
+}
@@ -0,0 +1,27 @@
+// IF frequency estimation from edge timings, shared by sensing backends
+// copyright simulistics ltd
+
+#define TIMECONST	0.04 // smoother time constant, s
+
+// estimators
+#define SMOOTH		0 // exponential smoother, same lag at any speed
+#define TRACK		1 // alpha-beta tracker, quick when hand moves
+#define NESTS		2
+
+struct est {
+  int kind;
+  double freq; // Hz, what callers read
+  double period; // tracked period, s
+  double now, edges[2]; // time of this edge, and predicted last edges
+  int which, primed, measured; // measured unless period just given
+  double noise, drift; // typical and recent mean edge time error, s
+};
+
+extern char *estNames[NESTS];
+extern int estKind; // used by estInit
+
+int findEst(char *name);
+void estInit(struct est *e, double freq);
+void estBreak(struct est *e); // gap in edges, eg between captures
+// period between like edges, dt since previous edge, both in seconds
+double estUpdate(struct est *e, double period, double dt);
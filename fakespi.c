@@ -0,0 +1,82 @@
+// stand-in for spidev, makes IF bitstreams for testing without hardware
+// copyright simulistics ltd
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#include "scan.h"
+#include "spi.h"
+#include "fakespi.h"
+
+double fakeIF[2] = {3000, 3000}; // beat frequency on each bus
+int fakeBusTime = 1; // take as long as real transfer would
+
+static struct {
+  uint32_t speed;
+  double phase; // of IF at start of next transfer
+} fakes[2];
+
+// len bytes sampling IF square wave at fs, with bits within a sample of
+// an edge sometimes landing on the wrong side as clock jitter does;
+// for spi1 apply the 24-bit phase reversals the scanner has to undo
+void fakeBits(unsigned char *bufr, int len, int side, double fs,
+	      double freq, double *phase) {
+  static const uint32_t masks[3] = {0x000000ff, 0xffff0000, 0x00ffffff};
+  double at, near = freq/fs; // one sample, in cycles
+  int i, bit;
+
+  for (i=0; i<8*len; ++i) {
+    at = fmod(*phase + i*freq/fs, 1.0);
+    bit = at < 0.5;
+    if ((fabs(at-0.5) < near || at < near || at > 1-near) && rand()%4 == 0)
+      bit = !bit;
+    if (side && masks[(i/32)%3]>>(31-i%32) & 1) bit = !bit;
+    if (i%8 == 0) bufr[i/8] = 0;
+    bufr[i/8] |= bit << (7-i%8);
+  }
+  *phase = fmod(*phase + 8*len*freq/fs, 1.0);
+}
+
+static int fakeOpen(const char *path, int flags) {
+  return strchr(path, '1') ? 1 : 0; // fd is side
+}
+
+static int fakeIoctl(int fd, unsigned long req, void *arg) {
+  struct spi_ioc_transfer *xfers = arg;
+  struct timespec tv;
+  int i, n, len = 0;
+  double fs;
+
+  if (req == SPI_IOC_WR_MAX_SPEED_HZ) {
+    fakes[fd].speed = *(uint32_t*)arg;
+    return 0;
+  }
+  if (req == SPI_IOC_WR_MODE || req == SPI_IOC_WR_BITS_PER_WORD)
+    return 0;
+  // must be a message, size says how many transfers
+  n = _IOC_SIZE(req)/sizeof(*xfers);
+  for (i=0; i<n; ++i) {
+    fs = xfers[i].speed_hz ? xfers[i].speed_hz : fakes[fd].speed;
+    fakeBits((unsigned char*)(uintptr_t)xfers[i].rx_buf, xfers[i].len, fd,
+	     fs, fakeIF[fd], &fakes[fd].phase);
+    len += xfers[i].len;
+    if (fakeBusTime) {
+      tv.tv_sec = 0;
+      tv.tv_nsec = 8e9*xfers[i].len/fs;
+      nanosleep(&tv, NULL);
+    }
+  }
+  return len;
+}
+
+static int fakeClose(int fd) {
+  return 0;
+}
+
+struct spiOps fakeSpi = {fakeOpen, fakeIoctl, fakeClose};
@@ -0,0 +1,9 @@
+// stand-in for spidev, makes IF bitstreams for testing without hardware
+// copyright simulistics ltd
+
+extern struct spiOps fakeSpi;
+extern double fakeIF[2];
+extern int fakeBusTime;
+
+void fakeBits(unsigned char *bufr, int len, int side, double fs,
+	      double freq, double *phase);
@@ -0,0 +1,191 @@
+// effects applied to each voice after its oscillator
+// copyright simulistics ltd
+// a block at a time, each effect over the whole block in turn; delay
+// lines are allocated and touched before playing starts, so the render
+// thread never allocates or page faults, and all maths is integer
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "synth.h"
+#include "fx.h"
+
+#define LFO_BITS	10 // vibrato sine table
+#define LFO_STEP	((uint32_t)(5.5*4294967296.0/PCM_RATE)) // 5.5Hz
+#define VIB_DEPTH	40 // most delay swing in frames, about 50 cents
+#define LP_TOP		12000 // low-pass cutoff just turned on, Hz
+#define LP_BOTTOM	300 // and turned right up
+#define ECHO_FB		22000 // Q15 feedback turned right up
+#define COMB_FB		27525 // Q15, 0.84 as freeverb's room
+#define COMB_DAMP	6554 // Q15, 0.2
+#define REV_GAIN	24576 // Q15 wet level turned right up
+
+char *fxNames[NFX] = {"vibrato", "low-pass", "echo", "reverb"};
+
+static const int combLen[NCOMBS] = {1116, 1188, 1277, 1356};
+static const int apLen[NALLPASS] = {556, 441};
+static int16_t lfo[(1<<LFO_BITS)+1];
+static int32_t lpCoefs[FX_MAX+1];
+
+static inline int16_t sat16(int32_t x) {
+  return x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+}
+
+// tables so setting an effect needs no maths in either build
+void fxInit() {
+  int i;
+
+  for (i=0; i<=1<<LFO_BITS; ++i)
+    lfo[i] = lrint(32767*sin(2*M_PI*i/(1<<LFO_BITS)));
+  for (i=0; i<=FX_MAX; ++i) // cutoff falls exponentially
+    lpCoefs[i] = lrint(32768*(1 - exp(-2*M_PI*LP_TOP*
+      pow((double)LP_BOTTOM/LP_TOP, (double)i/FX_MAX)/PCM_RATE)));
+}
+
+// returns 0 if no memory
+int fxAlloc(struct fx *f) {
+  int i, len = VIB_LINE + ECHO_LINE;
+  int16_t *p;
+
+  for (i=0; i<NCOMBS; ++i)
+    len += combLen[i];
+  for (i=0; i<NALLPASS; ++i)
+    len += apLen[i];
+  memset(f, 0, sizeof(*f));
+  if (!(p = f->lines = malloc(len*sizeof(*p))))
+    return 0;
+  memset(p, 0, len*sizeof(*p)); // fault pages in now, not while playing
+  f->vib = p; p += VIB_LINE;
+  f->echo = p; p += ECHO_LINE;
+  for (i=0; i<NCOMBS; ++i) {
+    f->comb[i] = p; p += combLen[i];
+  }
+  for (i=0; i<NALLPASS; ++i) {
+    f->allpass[i] = p; p += apLen[i];
+  }
+  return 1;
+}
+
+// new settings from control loop; an effect turned on starts silent
+void fxSet(struct fx *f, int *amount) {
+  int i, a;
+
+  for (i=0; i<NFX; ++i) {
+    a = amount[i] < 0 ? 0 : amount[i] > FX_MAX ? FX_MAX : amount[i];
+    if (a == f->amount[i])
+      continue;
+    if (!f->amount[i])
+      switch (i) {
+      case VIBRATO:
+	memset(f->vib, 0, VIB_LINE*sizeof(*f->vib));
+	break;
+      case LOWPASS:
+	f->lp = 0;
+	break;
+      case ECHO:
+	memset(f->echo, 0, ECHO_LINE*sizeof(*f->echo));
+	break;
+      case REVERB:
+	memset(f->comb[0], 0, (f->allpass[NALLPASS-1] + apLen[NALLPASS-1]
+			       - f->comb[0])*sizeof(*f->comb[0]));
+	memset(f->combLp, 0, sizeof(f->combLp));
+      }
+    f->amount[i] = a;
+  }
+  f->vibDepth = VIB_DEPTH*256*f->amount[VIBRATO]/FX_MAX;
+  f->lpCoef = lpCoefs[f->amount[LOWPASS]];
+  f->echoGain = ECHO_FB*f->amount[ECHO]/FX_MAX;
+  f->revGain = REV_GAIN*f->amount[REVERB]/FX_MAX;
+}
+
+int fxActive(struct fx *f) {
+  int i;
+
+  for (i=0; i<NFX; ++i)
+    if (f->amount[i])
+      return 1;
+  return 0;
+}
+
+// pitch wobble as a delay line read at a swinging distance
+static void vibrato(struct fx *f, int16_t *buffer, int n) {
+  uint32_t idx, frac;
+  int32_t l, d, a, b;
+  int i, pos = f->vibPos, at;
+
+  for (i=0; i<n; ++i) {
+    f->vib[pos] = buffer[i];
+    idx = f->lfoPhase >> (32-LFO_BITS);
+    frac = (f->lfoPhase >> (32-LFO_BITS-15)) & 0x7fff;
+    l = lfo[idx] + (((lfo[idx+1]-lfo[idx])*(int32_t)frac) >> 15);
+    f->lfoPhase += LFO_STEP;
+    d = (VIB_DEPTH+2)*256 + ((f->vibDepth*l) >> 15); // Q8 frames back
+    at = pos - (d >> 8);
+    a = f->vib[at & (VIB_LINE-1)];
+    b = f->vib[(at-1) & (VIB_LINE-1)];
+    buffer[i] = a + (((b-a)*(d & 255)) >> 8);
+    pos = (pos+1) & (VIB_LINE-1);
+  }
+  f->vibPos = pos;
+}
+
+// one pole, darker as it is turned up
+static void lowpass(struct fx *f, int16_t *buffer, int n) {
+  int32_t lp = f->lp, c = f->lpCoef;
+  int i;
+
+  for (i=0; i<n; ++i) {
+    lp += ((buffer[i]<<8) - lp)*(int64_t)c >> 15; // Q8 for headroom
+    buffer[i] = lp >> 8;
+  }
+  f->lp = lp;
+}
+
+// repeats fading by feedback, heard at the same level
+static void echo(struct fx *f, int16_t *buffer, int n) {
+  int32_t g = f->echoGain, back;
+  int i, pos = f->echoPos;
+
+  for (i=0; i<n; ++i) {
+    back = f->echo[(pos - ECHO_DELAY) & (ECHO_LINE-1)];
+    f->echo[pos] = buffer[i] = sat16(buffer[i] + ((back*g) >> 15));
+    pos = (pos+1) & (ECHO_LINE-1);
+  }
+  f->echoPos = pos;
+}
+
+// Schroeder: damped combs in parallel then allpasses in series
+static void reverb(struct fx *f, int16_t *buffer, int n) {
+  int32_t in, out, o, b;
+  int i, k;
+
+  for (i=0; i<n; ++i) {
+    in = buffer[i] >> 3; // room for the combs adding up
+    out = 0;
+    for (k=0; k<NCOMBS; ++k) {
+      o = f->comb[k][f->combPos[k]];
+      f->combLp[k] = o + (((f->combLp[k] - o)*COMB_DAMP) >> 15);
+      f->comb[k][f->combPos[k]] =
+	sat16(in + ((f->combLp[k]*COMB_FB) >> 15));
+      if (++f->combPos[k] == combLen[k]) f->combPos[k] = 0;
+      out += o;
+    }
+    for (k=0; k<NALLPASS; ++k) { // gain 1/2
+      b = f->allpass[k][f->apPos[k]];
+      f->allpass[k][f->apPos[k]] = sat16(out + (b >> 1));
+      out = b - out;
+      if (++f->apPos[k] == apLen[k]) f->apPos[k] = 0;
+    }
+    buffer[i] = sat16(buffer[i] + ((out*f->revGain) >> 15));
+  }
+}
+
+void fxProcess(struct fx *f, int16_t *buffer, int n) {
+  if (f->amount[VIBRATO]) vibrato(f, buffer, n);
+  if (f->amount[LOWPASS]) lowpass(f, buffer, n);
+  if (f->amount[ECHO]) echo(f, buffer, n);
+  if (f->amount[REVERB]) reverb(f, buffer, n);
+}
@@ -0,0 +1,35 @@
+// effects applied to each voice after its oscillator
+// copyright simulistics ltd
+
+// effects, in the order they are applied
+#define VIBRATO		0
+#define LOWPASS		1
+#define ECHO		2
+#define REVERB		3
+#define NFX		4
+
+#define FX_MAX		100 // most any effect can be turned up, 0 is off
+#define VIB_LINE	256 // delay line lengths in frames, powers of 2
+#define ECHO_LINE	32768
+#define ECHO_DELAY	(PCM_RATE*3/10)
+#define NCOMBS		4 // reverb is parallel combs into allpasses
+#define NALLPASS	2
+
+struct fx { // one per voice, all integer so both builds share it
+  int amount[NFX]; // settings in force, 0..FX_MAX
+  int16_t *lines; // every delay line, allocated up front
+  int16_t *vib, *echo, *comb[NCOMBS], *allpass[NALLPASS];
+  int vibPos, echoPos, combPos[NCOMBS], apPos[NALLPASS];
+  uint32_t lfoPhase;
+  int32_t vibDepth; // delay swing, Q8 frames
+  int32_t lpCoef, lp; // Q15
+  int32_t echoGain, revGain, combLp[NCOMBS]; // Q15
+};
+
+extern char *fxNames[NFX];
+
+void fxInit();
+int fxAlloc(struct fx *f);
+void fxSet(struct fx *f, int *amount);
+int fxActive(struct fx *f);
+void fxProcess(struct fx *f, int16_t *buffer, int n);
@@ -0,0 +1,48 @@
+// recording of sensed IFs for later replay
+// copyright simulistics ltd
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "sense.h"
+#include "iflog.h"
+
+char *replayFiles[MAX_INST];
+int nReplays = 0;
+int replayFast = 0;
+
+static FILE *logStm = NULL;
+static struct timespec logStart;
+
+int openIFLog(char *fileName) {
+  struct ifHeader hdr;
+
+  if (!(logStm = fopen(fileName, "wb"))) {
+    perror(fileName);
+    return 0;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, IFLOG_MAGIC, sizeof(hdr.magic));
+  hdr.version = IFLOG_VERSION;
+  fwrite(&hdr, sizeof(hdr), 1, logStm);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &logStart);
+  return 1;
+}
+
+// stdio buffers these, flushed at exit; sensed is CLOCK_MONOTONIC_RAW
+void logIFs(int inst, int p, int v, struct timespec *sensed) {
+  struct ifRecord rec;
+  int64_t usec;
+
+  if (!logStm) return;
+  usec = (int64_t)(sensed->tv_sec-logStart.tv_sec)*1000000 +
+    (sensed->tv_nsec-logStart.tv_nsec)/1000;
+  memset(&rec, 0, sizeof(rec));
+  rec.usec = usec < 0 ? 0 : usec;
+  rec.p = p;
+  rec.v = v;
+  rec.inst = inst;
+  fwrite(&rec, sizeof(rec), 1, logStm);
+}
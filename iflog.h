@@ -0,0 +1,25 @@
+// recording of sensed IFs for later replay
+// copyright simulistics ltd
+
+// needs sense.h
+
+#define IFLOG_MAGIC	"MTSIFLOG"
+#define IFLOG_VERSION	2
+
+struct ifHeader {
+  char magic[8];
+  uint32_t version, pad;
+};
+
+struct ifRecord { // one per new reading
+  uint64_t usec; // sensed, since recording started
+  int32_t p, v; // pitch and volume IFs in Hz
+  uint32_t inst, pad; // instrument it was read for
+};
+
+extern char *replayFiles[MAX_INST]; // for replay backend, 1 or more pairs each
+extern int nReplays;
+extern int replayFast; // replay ignoring recorded timing
+
+int openIFLog(char *fileName);
+void logIFs(int inst, int p, int v, struct timespec *sensed);
@@ -10,17 +10,33 @@
 #include <stdint.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
 
 #include <sys/param.h>
 #include <alsa/asoundlib.h>
   // from pcm_min.c
 
-#define PCM_RATE 44100
+#include "synth.h"
+#include "fx.h"
+#include "sense.h"
+#include "snap.h"
+#include "audio.h"
+#include "iflog.h"
+#include "tune.h"
+#include "voice.h"
+#include "stats.h"
+#include "est.h"
+#include "calib.h"
+#include "stream.h"
+#include "rt.h"
+#include "trace.h"
 
 #define TOUCHED		12000 // IF exceeded if antenna is touched
 #define TOUCH_P         1 // flags to set if antennae touched
 #define TOUCH_V         2
+#define WAKE_NS		100000000 // longest wait for readings, for stats
 
 // Player states
 #define STANDBY		0
@@ -31,326 +47,512 @@
 #define SET_TONE	5
 #define AUTOTUNE        6
 #define TUNING          7
+#define SET_FX		8 // picking an effect
+#define SET_FX_AMT	9 // and how much of it
 
-// tones
-#define	SINE		0
-#define	CLASSIC		1
-#define	VALVE		2
-#define	TRIANGLE	3
-#define	SAWTOOTH	4
-#define	SQUARE		5
-
-// autotune modes
-#define CONTINUOUS      0
-#define CHROMATIC       1
-#define MAJOR           2
-#define BLACK           3
-#define FLOYDIAN        4
-#define ARPEGGIO        5
-#define AEOLIAN         6
-
-void setupSensing();
-void getTSs(int*, int*);
-void getIFs(int*, int*);
 /* include to use sensed values from stdin/stdout 
-void setupSensing() {};
-void getIFs(int* p, int* v) {
+int setupSensing() { return 1; };
+void getIFs(int n, int* p, int* v) {
   char q;
   printf("0\n?\n");
   fflush(stdout);
   do scanf("%c %d %d\n", &q, p, v); while (q=='?');
 }
 */
-FILE* say(char *fileName) {
-  FILE* stm;
-  int16_t throwaway[22];
-  char tgt[256];
-
-  sprintf(tgt, "/usr/local/lib/mts/%s", fileName);
-  stm = fopen(tgt, "r");
-  if (stm) fread(throwaway, 2, 22, stm); // wav header
-  return stm;
+// prompts are all in memory, this just finds one
+struct prompt *say(char *fileName) {
+  return findPrompt(fileName);
 }
 
-///////// MAIN ROUTINE HERE //////////
-int main(int argc, char* argv[]) {
-  struct timespec tv;
-  int pitch_if, vol_if, baseLineP, baseLineV;
-  double phase = 0, phaseIncr, beingEdited,
-    curPitch = 0, pitchAdj, tgtPitch,
-    curVol = 0, volAdj, tgtVol;
+// one per antenna pair, each with its own settings and menu state
+struct theremin {
+  int inst; // sensing instance and mixer voice
   // settings are integers
-  int vol = 50, pitch = 50, pRange = 50, tuning = 440,
-    currentTone = SINE, autotune = CONTINUOUS, wrk,
-    *current, *next;
-  // pthread_t thread_id;
+  int vol, pitch, pRange, tuning, currentTone, autotune;
+  int fx[NFX], fxPick;
+  int baseLineP, baseLineV, touched, state, nextState;
+  int *current;
+  double beingEdited;
+  char *curDesc;
+  struct prompt *speech;
+  unsigned int seen; // version of newest reading acted on
+} theremins[MAX_INST];
 
-  int16_t buffer[PCM_RATE/25]; // 40ms worth, overkill
-  int touching = 0, touched = 0, state = PLAY, nextState;
-  char *curDesc, *nxtDesc, *nxtSpeak;
-  FILE* speech = NULL;
+void initTheremin(struct theremin *t, int inst) {
+  struct theremin init = {inst, 50, 50, 50, 440, SINE, CONTINUOUS};
 
-  // from pcm_min.c
-  int err;
-  unsigned int i, ns_p, ns_v, old_sample = 0, old_ns = 0, req_ms, sendSiz;
-  snd_pcm_sframes_t frames;
-  snd_pcm_t *handle;
+  *t = init;
+  t->state = PLAY;
+}
 
-  setupSensing();
-  tv.tv_sec = 0;
-  tv.tv_nsec = 1e8;
-  nanosleep(&tv, NULL); // let IF detection settle
-  getIFs(&baseLineP, &baseLineV);
-  fprintf(stderr, "IFs: pitch %d, vol %d\n", baseLineP, baseLineV);
-  
-  if ((err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0)
-    {
-    fprintf(stderr, "Playback open error: %s\n", snd_strerror(err));
-    exit(EXIT_FAILURE);
+#ifdef FIXED
+// note to play given pitch IF above baseline, as phase step
+pitch_t pitchFor(struct theremin *t, int d) {
+  int32_t lg;
+
+  if (d <= 0)
+    return 0;
+  lg = (fixLog2(d) - fixLog2(t->tuning))*t->pRange/50 +
+    fixLog2(t->pitch) - fixLog2(50) + 20*65536; // TUNE_ONE is 2^20
+  // Hz is tuning*q/TUNE_ONE, a cycle is 2^32
+  return ((int64_t)t->tuning*quantize(t->autotune, fixExp2(lg)) << 12)
+    / PCM_RATE;
+}
+
+// exp(-d/250) at full volume
+vol_t expDecay(int d) {
+  // Q16 log2 of result as Q30, 65536/250/ln 2 = 24203/64
+  int64_t lg = 30*65536 - ((int64_t)d*24203 >> 6);
+
+  return lg >= 31*65536 ? INT32_MAX : fixExp2(lg);
+}
+
+// (int)(2*log(1+d)) for picking among settings
+int logStep(int d) {
+  return d < 0 ? 0 : (int64_t)fixLog2(1+d)*45426 >> 31; // 2 ln 2 in Q15
+}
+#else
+// note to play given pitch IF above baseline
+pitch_t pitchFor(struct theremin *t, int d) {
+  double tgt;
+
+  tgt = t->pitch*TUNE_ONE*pow(d*1.0/t->tuning,t->pRange/50.0)/50;
+  return t->tuning*quantize(t->autotune, tgt)/TUNE_ONE;
+}
+
+vol_t expDecay(int d) {
+  return exp(-d/250.0);
+}
+
+int logStep(int d) {
+  return (int)(log(1+d)*2);
+}
+#endif
+
+// loudness to play given volume IF above baseline
+vol_t volFor(struct theremin *t, int d) {
+  return expDecay(d)/100*t->vol;
+}
+
+// drive synth with a swept gesture in every tone and autotune mode,
+// as fast as output allows, to measure throughput; each instrument
+// has its own gesture phase so voices differ
+double headlessRun(int nInst, double secs, int report) {
+  struct theremin *t;
+  struct ctl ctl = {0, 0, SINE, 1, NULL};
+  struct timespec t0, t1;
+  int16_t buffer[MAX_BLOCK];
+  long frame, frames = secs*PCM_RATE;
+  int tone, scale, n;
+  double tp, wall, allWall = 0;
+
+  setVoices(nInst);
+  if (report)
+    printf("tone       autotune    rendered s/wall s\n");
+  for (tone=SINE; tone<NTONES; ++tone)
+    for (scale=CONTINUOUS; scale<nScales; ++scale) {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      for (frame=0; frame<frames; frame += period) {
+	for (n=0; n<nInst; ++n) {
+	  t = theremins + n;
+	  t->currentTone = tone;
+	  t->autotune = scale;
+	  tp = (double)frame/PCM_RATE + n*0.37;
+	  // pitch hand sweeps 100-2000Hz over 3s, volume hand waves at 2Hz
+	  ctl.pitch = pitchFor(t, 1050 - 950*cos(2*M_PI*tp/3));
+	  ctl.vol = volFor(t, 500 - 500*cos(2*M_PI*tp*2))/nInst;
+	  ctl.tone = tone;
+	  ctl.glide = scale == CONTINUOUS;
+	  sendCtl(n, &ctl);
+	}
+	playBlock(buffer, period);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      wall = (t1.tv_sec-t0.tv_sec) + 1e-9*(t1.tv_nsec-t0.tv_nsec);
+      allWall += wall;
+      if (report)
+	printf("%-10s %-11s %8.1lf\n", toneNames[tone],
+	       scales[scale].name, secs/wall);
     }
-  if ((err = snd_pcm_set_params(handle,
-				SND_PCM_FORMAT_S16_LE,
-				SND_PCM_ACCESS_RW_INTERLEAVED,
-				1, // channels
-				PCM_RATE,
-				1,
-				50000)) < 0) {   /* 0.05sec */
-    fprintf(stderr, "Playback open error: %s\n", snd_strerror(err));
-    exit(EXIT_FAILURE);
+  if (report)
+    printf("overall                %8.1lf\n",
+	   NTONES*nScales*secs/allWall);
+  return NTONES*nScales*secs/allWall;
+}
+
+void headless(int nInst, double secs) {
+  int n;
+
+  headlessRun(nInst, secs, 1);
+  if (nInst < 2)
+    return;
+  printf("\ninstruments  rendered s/wall s  voice s/wall s\n");
+  for (n=1; n<=nInst; ++n) {
+    double rate = headlessRun(n, secs, 0);
+    printf("%11d %18.1lf %15.1lf\n", n, rate, rate*n);
   }
-  speech = say("play.wav");
-  for (;;) {
-    req_ms = 0;
-    
-    getTSs(&ns_p, &ns_v);
-    tv.tv_sec = 0;
-    tv.tv_nsec = 2e6;
-    while (ns_p == old_ns) {
-      nanosleep(&tv, NULL);
-      req_ms += 2;
-      getTSs(&ns_p, &ns_v);
-    }
-    old_ns = ns_p;
-    // now have new pitch value
-    sendSiz = (7 + req_ms)*PCM_RATE/1000; // amount of data to send
-    
-    getIFs(&pitch_if, &vol_if);
-    // Adjust offset freq if -ve beat detected! (only if both beats slow)
-    if (pitch_if<baseLineP && vol_if-baseLineV < 1000) {
-      fprintf(stderr, "Reducing P baseline by %d\n", baseLineP-(int)pitch_if);
-      baseLineP = (int)pitch_if;
-    }
-    if (vol_if<baseLineV && pitch_if-baseLineP < 1000) {
-      fprintf(stderr, "Reducing V baseline by %d\n", baseLineV-(int)vol_if);
-      baseLineV = (int)vol_if;
-    }
+}
 
-    touching = (pitch_if>TOUCHED?TOUCH_P:0) | (vol_if>TOUCHED?TOUCH_V:0);
-    if (touching)
-      touched |= touching;
-    else if (touched) {
-      if (state == PLAY) {
-	if (touched == (TOUCH_P|TOUCH_V)) { // both, not either
-	  state = STANDBY;
-	  speech = say("standby.wav");
-	} else if (touched == TOUCH_P)
-	  fprintf(stderr, "Pitch touched, current vol_if %d base %d\n",
-		  vol_if, baseLineV);
-	else if (touched == TOUCH_V)
-	  fprintf(stderr, "Vol touched, current pitch_if %d base %d\n",
-		  pitch_if, baseLineP);
-      } else if (state == STANDBY) {
-	if (touched == (TOUCH_P)) {
-	  state = SET_PITCH;
-	  curDesc = "pitch range";
-	  speech = say("prange.wav");
-	  beingEdited = pitch;
-	  current = &pitch;
-	}
-	if (touched == (TOUCH_V)) {
-	  state = SET_TONE;
-	  curDesc = "tone";
-	  speech = say("tone.wav");
-	  beingEdited = currentTone;
-	  current = &currentTone;
-	}
-	if (touched == (TOUCH_P|TOUCH_V)) {
-	  state = PLAY;
-	  baseLineP += 500;
-	  baseLineV += 500;
-	  speech = say("play.wav");
-	} else
-	  fprintf(stderr, "Setting %s\n", curDesc);
+// act on a new reading from one antenna pair, sensed at given time
+void control(struct theremin *t, int pitch_if, int vol_if,
+	     struct timespec *sensed) {
+  int *next, touching, sent;
+  char *nxtDesc, *nxtSpeak;
+  pitch_t tgtPitch;
+  vol_t tgtVol;
+  struct ctl ctl;
+  struct timespec tv = {0, 2e6};
+
+  TRACE_BEGIN("touch and state");
+  // Adjust offset freq if -ve beat detected! (only if both beats slow)
+  if (pitch_if<t->baseLineP && vol_if-t->baseLineV < 1000) {
+    fprintf(stderr, "%d: Reducing P baseline by %d\n", t->inst,
+	    t->baseLineP-(int)pitch_if);
+    t->baseLineP = (int)pitch_if;
+  }
+  if (vol_if<t->baseLineV && pitch_if-t->baseLineP < 1000) {
+    fprintf(stderr, "%d: Reducing V baseline by %d\n", t->inst,
+	    t->baseLineV-(int)vol_if);
+    t->baseLineV = (int)vol_if;
+  }
+
+  touching = (pitch_if>TOUCHED?TOUCH_P:0) | (vol_if>TOUCHED?TOUCH_V:0);
+  if (touching)
+    t->touched |= touching;
+  else if (t->touched) {
+    if (t->state == PLAY) {
+      if (t->touched == (TOUCH_P|TOUCH_V)) { // both, not either
+	t->state = STANDBY;
+	t->speech = say("standby.wav");
+      } else if (t->touched == TOUCH_P)
+	fprintf(stderr, "Pitch touched, current vol_if %d base %d\n",
+		vol_if, t->baseLineV);
+      else if (t->touched == TOUCH_V)
+	fprintf(stderr, "Vol touched, current pitch_if %d base %d\n",
+		pitch_if, t->baseLineP);
+    } else if (t->state == STANDBY) {
+      if (t->touched == (TOUCH_P)) {
+	t->state = SET_PITCH;
+	t->curDesc = "pitch range";
+	t->speech = say("prange.wav");
+	t->beingEdited = t->pitch;
+	t->current = &t->pitch;
+      }
+      if (t->touched == (TOUCH_V)) {
+	t->state = SET_TONE;
+	t->curDesc = "tone";
+	t->speech = say("tone.wav");
+	t->beingEdited = t->currentTone;
+	t->current = &t->currentTone;
+      }
+      if (t->touched == (TOUCH_P|TOUCH_V)) {
+	t->state = PLAY;
+	t->baseLineP += 500;
+	t->baseLineV += 500;
+	t->speech = say("play.wav");
+      } else
+	fprintf(stderr, "%d: Setting %s\n", t->inst, t->curDesc);
+    } else {
+      if (t->touched == (TOUCH_P))
+	fprintf(stderr, "%d: Set %s to %d\n", t->inst, t->curDesc,
+		*t->current);
+      else
+	*t->current = t->beingEdited;
+
+      switch (t->state) {
+      case SET_TONE:
+	next = &t->vol;
+	t->nextState = SET_VOL;
+	nxtDesc = "volume range";
+	nxtSpeak = "vrange.wav";
+	break;
+      case SET_PITCH:
+	next = &t->pRange;
+	t->nextState = SET_SLOPE_P;
+	nxtDesc = "pitch slope";
+	nxtSpeak = "pslope.wav";
+	break;
+      case SET_SLOPE_P:
+	next = &t->autotune;
+	t->nextState = AUTOTUNE;
+	nxtDesc = "autotune";
+	nxtSpeak = "autotune.wav";
+	break;
+      case AUTOTUNE:
+	next = &t->tuning;
+	t->nextState = TUNING;
+	nxtDesc = "tuning";
+	nxtSpeak = "tuning.wav";
+	break;
+      case SET_VOL:
+	next = &t->fxPick;
+	t->nextState = SET_FX;
+	nxtDesc = "effect";
+	nxtSpeak = "effect.wav"; // chime cues until recorded
+	break;
+      case SET_FX:
+	next = t->fx + t->fxPick;
+	t->nextState = SET_FX_AMT;
+	nxtDesc = fxNames[t->fxPick];
+	nxtSpeak = "fxamount.wav";
+	break;
+      default: // last state in series
+	next = NULL;
+      }
+
+      if (t->touched == (TOUCH_P|TOUCH_V) || next == NULL) {
+	t->state = PLAY;
+	t->speech = say("play.wav");
       } else {
-	switch (state) {
-	case SET_TONE:
-	  next = &vol;
-	  nextState = SET_VOL;
-	  nxtDesc = "volume range";
-	  nxtSpeak = "vrange.wav";
-	  break;
-	case SET_PITCH:
-	  next = &pRange;
-	  nextState = SET_SLOPE_P;
-	  nxtDesc = "pitch slope";
-	  nxtSpeak = "pslope.wav";
-	  break;
-	case SET_SLOPE_P:
-	  next = &autotune;
-	  nextState = AUTOTUNE;
-	  nxtDesc = "autotune";
-	  nxtSpeak = "autotune.wav";
-	  break;
-	case AUTOTUNE:
-	  next = &tuning;
-	  nextState = TUNING;
-	  nxtDesc = "tuning";
-	  nxtSpeak = "tuning.wav";
-	  break;
-	default: // last state in series
-	  next = NULL;
-	}
-	
-	if (touched == (TOUCH_P))
-	  fprintf(stderr, "Set %s to %d\n", curDesc, *current);
-	else
-	  *current = beingEdited;
-	if (touched == (TOUCH_P|TOUCH_V) || next == NULL) {
-	  state = PLAY;
-	  speech = say("play.wav");
-	} else {
-	  state = nextState;
-	  current = next;
-	  curDesc = nxtDesc;
-	  beingEdited = *current;
-	  fprintf(stderr, "Setting %s\n", curDesc);
-	  speech = say(nxtSpeak);
-	}
+	t->state = t->nextState;
+	t->current = next;
+	t->curDesc = nxtDesc;
+	t->beingEdited = *t->current;
+	fprintf(stderr, "%d: Setting %s\n", t->inst, t->curDesc);
+	t->speech = say(nxtSpeak);
       }
-      touched = 0;
     }
+    t->touched = 0;
+  }
+
+  switch (t->state) {
+  case STANDBY:
+    tgtVol = 0;
+    break;
+  case PLAY:
+    tgtVol = volFor(t, vol_if-t->baseLineV);
+    break;
+  case SET_VOL:
+    tgtVol = expDecay(vol_if-t->baseLineV); // ignore setting while setting
+    break;
+  default: // using vol antenna to set attr so fix volume
+    tgtVol = VOL_ONE/1000*3*t->vol;
+  }
+
+  switch (t->state) {
+  case SET_VOL:
+    t->vol = tgtVol/(VOL_ONE/100);
+    break;
+  case SET_TONE:
+    t->currentTone = logStep(vol_if-t->baseLineV) - 8;
+    if (t->currentTone < SINE) t->currentTone = SINE;
+    if (t->currentTone > SQUARE) t->currentTone = SQUARE;
+    break;
+  case SET_PITCH:
+    t->pitch = 10 + (vol_if-t->baseLineV)/20;
+    break;
+  case SET_SLOPE_P:
+    t->pRange = 10 + (vol_if-t->baseLineV)/20;
+    break;
+  case AUTOTUNE:
+    t->autotune = logStep(vol_if-t->baseLineV) - 8;
+    if (t->autotune>=nScales) t->autotune = nScales-1;
+    if (t->autotune<CONTINUOUS) t->autotune = CONTINUOUS;
+    break;
+  case TUNING:
+    t->tuning = 300 + (vol_if-t->baseLineV)/5;
+    break;
+  case SET_FX:
+    t->fxPick = logStep(vol_if-t->baseLineV) - 8;
+    if (t->fxPick >= NFX) t->fxPick = NFX-1;
+    if (t->fxPick < 0) t->fxPick = 0;
+    break;
+  case SET_FX_AMT:
+    t->fx[t->fxPick] = (vol_if-t->baseLineV)/20;
+    if (t->fx[t->fxPick] > FX_MAX) t->fx[t->fxPick] = FX_MAX;
+    if (t->fx[t->fxPick] < 0) t->fx[t->fxPick] = 0;
+  }
+
+  tgtPitch = pitchFor(t, pitch_if-t->baseLineP);
+  TRACE_END("touch and state");
+
+  TRACE_BEGIN("send");
+  ctl.pitch = tgtPitch;
+  ctl.vol = tgtVol/nVoices; // leave headroom in the mix
+  ctl.tone = t->currentTone;
+  ctl.glide = t->autotune == CONTINUOUS;
+  ctl.speech = t->speech;
+  ctl.sensed = *sensed;
+  memcpy(ctl.fx, t->fx, sizeof(ctl.fx));
+  while (!(sent = sendCtl(t->inst, &ctl)) && replayFast)
+    nanosleep(&tv, NULL); // replaying faster than audio can take it
+  if (sent)
+    t->speech = NULL; // on its way, say it just once
+  else {
+    ++stats->ctlFull;
+    fprintf(stderr, "%d: Control queue full, audio stalled\n", t->inst);
+  }
+  streamCtl(t->inst, tgtPitch, tgtVol, sensed); // to soft synths, if any
+  TRACE_END("send");
+}
+
+///////// MAIN ROUTINE HERE //////////
+int main(int argc, char* argv[]) {
+  struct timespec tv;
+  struct theremin *t;
+  struct ifSnap snap;
+  unsigned int events;
+  int opt, n, nInst = 1;
+  double headSecs = 0, jitSecs = 0;
+  char *output = NULL, *ctlOut = NULL;
 
-    switch (state) {
-    case STANDBY:
-      tgtVol = 0;
+  initScales();
+  while ((opt = getopt(argc, argv, "w:r:fo:p:P:F:e:CH:n:s:d:c:b:R:t:J:")) != -1) {
+    switch (opt) {
+    case 'w': // record IFs as played
+      if (!openIFLog(optarg)) exit(EXIT_FAILURE);
       break;
-    case PLAY:
-      tgtVol = exp(-(vol_if-baseLineV)/250.0)*vol/100.0;
+    case 'r': // replay recorded IFs, replay build only, up to MAX_INST files
+      if (nReplays == MAX_INST) {
+	fprintf(stderr, "At most %d replays\n", MAX_INST);
+	exit(EXIT_FAILURE);
+      }
+      replayFiles[nReplays++] = optarg;
       break;
-    case SET_VOL:
-      tgtVol = exp(-(vol_if-baseLineV)/250.0); // ignore setting while setting
+    case 'f': // replay as fast as possible
+      replayFast = 1;
       break;
-    default: // using vol antenna to set attr so fix volume
-      tgtVol = 0.3*vol/100.0;      
-    }
-    
-    switch (state) {
-    case SET_VOL:
-      vol = (int)(100*tgtVol);
+    case 'o': // alsa[:device], plug[:device], wav:file or null
+      output = optarg;
+      break;
+    case 'p': // frames per period, device may round it
+      period = atoi(optarg);
+      if (period < 16 || period > MAX_BLOCK) {
+	fprintf(stderr, "Period must be 16-%d frames\n", MAX_BLOCK);
+	exit(EXIT_FAILURE);
+      }
+      break;
+    case 'P': // periods in device buffer
+      nPeriods = atoi(optarg);
+      if (nPeriods < 2) {
+	fprintf(stderr, "Need at least 2 periods\n");
+	exit(EXIT_FAILURE);
+      }
       break;
-    case SET_TONE:
-      currentTone = (int)(log(1+vol_if-baseLineV)*2) - 8;
-      if (currentTone < SINE) currentTone = SINE;
-      // currentTone = (vol_if-baseLineV)/200;
+    case 'F': // ms of audio to keep queued, rather than whole buffer
+      fillTarget = atof(optarg)*PCM_RATE/1000;
+      if (fillTarget < 0 || fillTarget > MAX_BLOCK) {
+	fprintf(stderr, "Fill level must be 0-%dms\n",
+		MAX_BLOCK*1000/PCM_RATE);
+	exit(EXIT_FAILURE);
+      }
       break;
-    case SET_PITCH:
-      pitch = 10 + (vol_if-baseLineV)/20;
+    case 'e': // IF estimator, smooth or track
+      if ((estKind = findEst(optarg)) < 0) {
+	fprintf(stderr, "Unknown estimator %s, try smooth or track\n", optarg);
+	exit(EXIT_FAILURE);
+      }
       break;
-    case SET_SLOPE_P:
-      pRange = 10 + (vol_if-baseLineV)/20;
+    case 'C': // calibrate from scratch, ignoring cached clocks
+      calibCold = 1;
       break;
-    case AUTOTUNE:
-      autotune = (int)(log(1+vol_if-baseLineV)*2) - 8;
-      if (autotune>AEOLIAN) autotune = AEOLIAN;
-      if (autotune<CONTINUOUS) autotune = CONTINUOUS;
+    case 'H': // no sensing, time synth on made-up gestures
+      headSecs = atof(optarg);
       break;
-    case TUNING:
-      tuning = 300 + (vol_if-baseLineV)/5;
-    }
-
-    tgtPitch = pitch*4096*pow((pitch_if-baseLineP)*1.0/tuning,pRange/50.0)/50;
-    switch (autotune) {
-    case CHROMATIC:
-      tgtPitch = exp(log(2)*round(12*log(tgtPitch)/log(2))/12);
+    case 'n': // instruments played in headless mode
+      nInst = atoi(optarg);
+      if (nInst < 1 || nInst > MAX_INST) {
+	fprintf(stderr, "Instruments must be 1-%d\n", MAX_INST);
+	exit(EXIT_FAILURE);
+      }
       break;
-    case MAJOR:
-      wrk = round(7*log(tgtPitch)/log(2));
-      tgtPitch = exp(log(2)*((12*wrk+2)/7)/12.0);
+    case 's': // extra autotune scale from Scala file
+      if (!loadScale(optarg)) exit(EXIT_FAILURE);
       break;
-    case BLACK:
-      wrk = round(5*log(tgtPitch)/log(2));
-      tgtPitch = exp(log(2)*((12*wrk-3)/5)/12.0);
+    case 'd': // tone level under speech, 0-1
+      duck = atof(optarg);
+      if (duck < 0 || duck > 1) {
+	fprintf(stderr, "Duck level must be 0-1\n");
+	exit(EXIT_FAILURE);
+      }
       break;
-    case FLOYDIAN:
-      tgtPitch = exp(log(2)*round(4*log(tgtPitch)/log(2))/4);
+    case 'c': // controller stream, osc:[host:]port or midi:port
+      ctlOut = optarg;
       break;
-    case ARPEGGIO:
-      wrk = round(3*log(tgtPitch)/log(2));
-      tgtPitch = exp(log(2)*(wrk/3))*(4+wrk%3)/4;
+    case 'b': // most readings per controller packet
+      streamBatch = atoi(optarg);
       break;
-    case AEOLIAN:
-      tgtPitch = 2048*round(tgtPitch/2048);
+    case 'R': // most controller updates per second per instrument
+      streamRate = atof(optarg);
       break;
+    case 't': // real-time profile, eg audio=89@3,sense=79@2,nolock
+      if (!rtProfile(optarg)) exit(EXIT_FAILURE);
+      break;
+    case 'J': // no playing, time how late each thread would wake
+      jitSecs = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-o output] [-p period] [-P periods]"
+	      " [-F fill ms] [-e estimator] [-C] [-s scale.scl]... [-d duck]"
+	      " [-c osc:[host:]port|midi:port [-b batch] [-R rate]]"
+	      " [-t profile] [-J secs]"
+	      " [-w record] [-r replay]... [-f] [-H secs [-n instruments]]\n",
+	      argv[0]);
+      exit(EXIT_FAILURE);
     }
-    tgtPitch = tuning*tgtPitch/4096;
-    
-    if (speech) {
-      i = fread(buffer, 2, sendSiz, speech);
-      if (i<sendSiz) {
-	fclose(speech);
-	speech = NULL;
-      }
-    } else
-      i=0;
-
-    if (autotune == CONTINUOUS) // change pitch smoothly through buffer
-      pitchAdj = (tgtPitch - curPitch)/sendSiz;
-    else { // change pitch abruptly
-      curPitch = tgtPitch;
-      pitchAdj = 0;
+  }
+
+  rtStart();
+  if (output && !openSink(output)) exit(EXIT_FAILURE);
+  if (ctlOut && !openStream(ctlOut)) exit(EXIT_FAILURE);
+  if (jitSecs > 0) { // audio wakes once a period
+    rtRoles[RT_AUDIO].periodNs = rtRoles[RT_HELPER].periodNs =
+      1e9*period/PCM_RATE;
+    rtJitter(jitSecs);
+    return 0;
+  }
+  initWaves();
+  fxInit();
+  openStats();
+  openTrace();
+  if (headSecs > 0) {
+    if (!sink && !openSink("null")) exit(EXIT_FAILURE);
+    for (n=0; n<nInst; ++n)
+      initTheremin(theremins+n, n);
+    headless(nInst, headSecs);
+    return 0;
+  }
+  loadPrompts();
+  nInst = setupSensing();
+  tv.tv_sec = 0;
+  tv.tv_nsec = 1e8;
+  nanosleep(&tv, NULL); // let IF detection settle
+  for (n=0; n<nInst; ++n) {
+    t = theremins + n;
+    initTheremin(t, n);
+    getIFs(n, &t->baseLineP, &t->baseLineV);
+    fprintf(stderr, "%d: IFs: pitch %d, vol %d\n", n,
+	    t->baseLineP, t->baseLineV);
+  }
+
+  startAudio(nInst);
+  rtSelf(RT_CONTROL);
+  theremins[0].speech = say("play.wav");
+  // count events before looking, so none published meanwhile is missed
+  events = snapEvents();
+  for (;;) {
+    for (n=0; n<nInst; ++n) {
+      t = theremins + n;
+      getSnap(n, &snap);
+      if (snap.version == t->seen)
+	continue;
+      t->seen = snap.version;
+      logIFs(n, snap.ifs[0], snap.ifs[1], &snap.stamp);
+      TRACE_BEGIN("control");
+      control(t, snap.ifs[0], snap.ifs[1], &snap.stamp);
+      TRACE_END("control");
     }
-    volAdj = (tgtVol - curVol)/sendSiz;
-    // adjust volume gradually over batch to avoid crackle --
-    // if buffer part full of speech, jump to that point
-    curPitch += i*pitchAdj;
-    curVol += i*volAdj;
-    
-    for (; i<sendSiz; ++i) {
-      curPitch += pitchAdj;
-      phaseIncr = curPitch/PCM_RATE;
-      phase = fmod(phase+phaseIncr,1.0);
-      
-      curVol += volAdj;
-      switch ((int)currentTone) {
-      case SINE:      // sine wave (-cos = same phase as next two)
-	buffer[i] = 32768*curVol*-cos(2*3.14159*phase);
-      	break;
-      case CLASSIC:      // classic sound
-	buffer[i] = 32768*curVol*(pow(4*phase*(1-phase),2)-1);
-      	break;
-      case VALVE:      // valve sound
-	buffer[i] = 32768*curVol*(pow(4*phase*(1-phase),16)-1);
-      	break;
-      case TRIANGLE:       // triangle wave
-        buffer[i] = 32768*curVol*(phase>0.5?3-4*phase:4*phase-1);
-      	break;
-      case SAWTOOTH:       // sawtooth wave
-	buffer[i] = 32768*curVol*(2*phase-1);
-      	break;
-      default:       // square wave
-	buffer[i] = 32768*curVol*(phase>0.5?1:-1);
-      }
+    if (statsReq) { // kill -USR1 asked for them
+      statsReq = 0;
+      dumpStats(stderr);
     }
-
-    frames = snd_pcm_writei(handle, buffer, sendSiz);
-    if (frames < 0)
-      frames = snd_pcm_recover(handle, frames, 0);
-    if (frames < 0) {
-      fprintf(stderr, "snd_pcm_writei failed: %s\n", snd_strerror(frames));
-      break;
+    if (traceReq) { // kill -USR2
+      traceReq = 0;
+      dumpTrace(TRACE_FILE);
     }
-    if (frames > 0 && frames < sendSiz)
-      fprintf(stderr, "Short write (expected %li, wrote %li)\n", sendSiz, frames);
+    TRACE_BEGIN("wait");
+    events = snapWait(events, WAKE_NS);
+    TRACE_END("wait");
   }
   return 0;
 }
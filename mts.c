@@ -8,13 +8,23 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <pigpio.h>
+#include <signal.h>
 #include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include <sys/param.h>
 
+#include "sense.h"
+#include "snap.h"
+#include "est.h"
+#include "edges.h"
+#include "calib.h"
+#include "rt.h"
+#include "trace.h"
+
 // for custom hardware
 #define UNCERTAINTY 	50000 // of osc freqs
 #define IF_MIN 		3000 // freq offset of reference oscs at idle
@@ -28,57 +38,89 @@
 #define SENS_V 27
 #define PLLD_OLD 500000000
 
-// smoothing
-#define TIMECONST 0.04
-
-double pitch_if, vol_if;
-struct timespec pitch_ts, vol_ts;
-
-void logTrans(int pin, int edge, unsigned int actTime) {
-  static struct timing_t {
-    int lastEdge;
-    unsigned int lastUp, lastDown;
-  } timings[2] = {{0,0,0}, {0,0,0}}, *timing;
-  int lastPeriod;
-  double *freq;
-  struct timespec *tv;
-
-  // load context appropriate to current pin
-  if (pin==SENS_P) {
-    freq = &pitch_if;
-    timing = timings;
-    tv = &pitch_ts;
-  } else {
-    freq = &vol_if;
-    timing = timings + 1;
-    tv = &vol_ts;
-  }
-  
-  if (timing->lastUp == timing->lastDown) // first go, set up context
-    timing->lastUp = timing->lastDown = actTime - 1e6/IF_MAX;
-  
-  if (edge==timing->lastEdge || // old debounce clock jitter
-      actTime - (edge==RISING_EDGE?timing->lastDown:timing->lastUp) < 0.1e6/(*freq))
-    return;
+#define BATCH_NS	1000000 // how often edges queued by logTrans are decoded
 
-  clock_gettime(CLOCK_MONOTONIC_RAW, tv);
+// decoder's view, only its thread touches these
+static struct est ests[2];
+static struct edgeTiming timings[2];
+static struct timespec stamps[2];
 
-  timing->lastEdge = edge;
-  if (edge == RISING_EDGE) {
-    lastPeriod = actTime - timing->lastUp;
-    timing->lastUp = actTime;
-  } else {
-    lastPeriod = actTime - timing->lastDown;
-    timing->lastDown = actTime;
+// calibration asks decoder to restart an estimate
+static atomic_int resetReq[2];
+static double resetTo[2];
+
+// drain queued edges every BATCH_NS and publish new estimates
+static void* decodeLoop(void* dump) {
+  struct timespec tv, now;
+  unsigned int head, tail, tickNow, lost = 0;
+  struct edge *e;
+  long ago;
+  int32_t d;
+  double ifs[2];
+  int s, fresh, reset[2];
+
+  tv.tv_sec = 0;
+  tv.tv_nsec = BATCH_NS;
+  for (;;) {
+    nanosleep(&tv, NULL);
+    TRACE_BEGIN("decode");
+    fresh = 0;
+    for (s=0; s<2; ++s)
+      if ((reset[s] = atomic_load(&resetReq[s]))) {
+	estInit(ests+s, resetTo[s]);
+	fresh |= 1<<s;
+      }
+
+    // edge ticks are pigpio microseconds, relate them to our clock
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    tickNow = gpioTick();
+    tail = atomic_load_explicit(&edgeTail, memory_order_relaxed);
+    head = atomic_load_explicit(&edgeHead, memory_order_acquire);
+    for (; tail != head; ++tail) {
+      e = edges + tail%EDGE_RING;
+      s = e->pin != SENS_P;
+      if (decodeEdge(ests+s, timings+s, IF_MAX, e->edge, e->tick)) {
+	// edge may be stamped just after tickNow was read
+	d = (int32_t)(tickNow - e->tick);
+	if (d < 0) d = 0;
+	ago = 1000L*d;
+	stamps[s].tv_sec = now.tv_sec - ago/1000000000;
+	stamps[s].tv_nsec = now.tv_nsec - ago%1000000000;
+	if (stamps[s].tv_nsec < 0) {
+	  stamps[s].tv_nsec += 1000000000;
+	  --stamps[s].tv_sec;
+	}
+	fresh |= 1<<s;
+      }
+    }
+    atomic_store_explicit(&edgeTail, tail, memory_order_release);
+    if (fresh) {
+      ifs[0] = ests[0].freq;
+      ifs[1] = ests[1].freq;
+      snapPublish(0, fresh, ifs, stamps);
+    }
+    TRACE_END("decode");
+    for (s=0; s<2; ++s) // reset now visible
+      if (reset[s])
+	atomic_store(&resetReq[s], 0);
+    if (atomic_load(&edgesLost) != lost) {
+      lost = atomic_load(&edgesLost);
+      fprintf(stderr, "Edge queue overflowed, %u edges lost\n", lost);
+    }
   }
+  return NULL;
+}
 
-  // adjust frequency estimate
-  if (lastPeriod > 1e6*TIMECONST)
-    *freq = 1e6/lastPeriod;
-  else
-    *freq = (1-(1e-6*lastPeriod/TIMECONST))*(*freq) + 1/TIMECONST;
-// debounce clock jitter v2
-//  gpioGlitchFilter(pin, (int)(0.05e6/(IF_MIN>*freq?IF_MIN:*freq)));
+// start estimate for side s again from given freq, wait till done
+static void resetIF(int s, double freq) {
+  struct timespec tv;
+
+  resetTo[s] = freq;
+  atomic_store(&resetReq[s], 1);
+  tv.tv_sec = 0;
+  tv.tv_nsec = BATCH_NS;
+  while (atomic_load(&resetReq[s]))
+    nanosleep(&tv, NULL);
 }
 
 int setFreq(int pin, int freq) {
@@ -92,41 +134,28 @@ int setFreq(int pin, int freq) {
   }
 }
 
-void calibrate(int pin, int guess, double* freq) {  // try to find osc freq
-  struct timespec tv;
-  double low = 0, high = 0;
-  int base = 0, top = 0, i, b;
-  tv.tv_sec = 0;
-  tv.tv_nsec = (int)(4e9*TIMECONST);
-  
-  fprintf(stderr, "Calibrating pin %d to %d\n", pin, guess);
-  for (i=guess-UNCERTAINTY; i<=guess+UNCERTAINTY;i += IF_MAX-IF_MIN) { 
-    // range over which to search --
-    // increment equal to useful range so one reading will be within
-    *freq = UNCERTAINTY;
-    b = setFreq(pin, i/SUBSAMPLE);
-    nanosleep(&tv, NULL); // delay 0.1 sec to home to frequency
-
-    fprintf(stderr, "Hit %lf with %d at %d\n", *freq, b, i);
-    if (*freq >= IF_MIN && *freq < IF_MAX) { // a valid reading
-      if (low == 0) { // first one, clock is below osc freq
-	low = *freq;
-	base = b;
-      } else if (b+*freq > base+low+IF_MIN) { // clock now above osc freq
-	high = *freq;
-        top = b;
-	break;
-      }
-    }
-  }
-  i = (top*low + base*high)/(low+high) + IF_MIN; // osc freq plus quiescent IF
-  // i = 750000000/((1500000000/i)+1)/2; // go to exact factor of PLLD
-  b = setFreq(pin, i/SUBSAMPLE);
-  
-  *freq = IF_MIN;
-  fprintf(stderr, "Osc %d at %d\n", b, i);
+//// calibration, both antennas at once
+static int setClock(int s, int freq) {
+  return setFreq(s ? REF_V : REF_P, freq/SUBSAMPLE);
 }
 
+static void restartIFs() {
+  resetIF(0, UNCERTAINTY);
+  resetIF(1, UNCERTAINTY);
+}
+
+static void readIFs(double ifs[2]) {
+  struct ifSnap s;
+
+  getSnap(0, &s);
+  ifs[0] = s.ifs[0];
+  ifs[1] = s.ifs[1];
+}
+
+static struct calibOps calibOps = {
+  "mts", IF_MIN, IF_MAX, UNCERTAINTY, 0, setClock, restartIFs, readIFs
+};
+
 // stuff for clean shutdown, needed by gpio
 void sig_handler(int signo)
 {
@@ -142,7 +171,9 @@ void sig_handler(int signo)
   }
 }
 
-void setupSensing() {
+int setupSensing() {
+  int guess[2] = {550000, 500000}, clocks[2];
+
   gpioInitialise();
   
   // Prepare clean shutdown
@@ -158,22 +189,20 @@ void setupSensing() {
   gpioSetMode(SENS_P, PI_INPUT);
   gpioSetMode(SENS_V, PI_INPUT);
 
-  gpioSetAlertFunc(SENS_P, logTrans);
-  calibrate(REF_P, 550000, &pitch_if);
+  estInit(ests, IF_MIN);
+  estInit(ests+1, IF_MIN);
+  startThread(RT_SENSE, decodeLoop, NULL);
 
+  gpioSetAlertFunc(SENS_P, logTrans);
   gpioSetAlertFunc(SENS_V, logTrans);
-  calibrate(REF_V, 500000, &vol_if);
-}
-
-void getIFs(int *p, int *v) {
-  *p = pitch_if;
-  *v = vol_if;
+  // tracker homes in on a new clock within a few periods
+  calibOps.settleNs = estKind == TRACK ? 30000000 : 4e9*TIMECONST;
+  calibrate(&calibOps, guess, clocks);
+  resetIF(0, IF_MIN);
+  resetIF(1, IF_MIN);
+  return 1; // one antenna pair
 }
 
-void getTSs(int *p, int *v) {
-  *p = pitch_ts.tv_nsec;
-  *v = vol_ts.tv_nsec;
-}
 /* Include this to serve sensed values to stdin/stdout 
 int main () {
   setupSensing();
@@ -184,7 +213,7 @@ int main () {
     scanf("%c\n", &q);
     if (q == '?') continue; // sent as filler
     if (q == '!') sig_handler(SIGCONT); // leave
-    getIFs(&p, &v);
+    getIFs(0, &p, &v);
     printf("%c %d %d\n? 0 0\n", q, p, v);
     fflush(stdout);
   }
@@ -0,0 +1,63 @@
+// sample formats devices take natively, filled from the mixed block
+// copyright simulistics ltd
+// one writer per format and channel layout, made by macro so the format
+// and channel count are constants in each loop; the choice is made once
+// when the device opens, never per sample
+
+#include <stdint.h>
+
+#include "pcm.h"
+
+char *pcmNames[NPCM] = {"S16_LE", "S32_LE", "S24_LE", "FLOAT_LE"};
+int pcmBytes[NPCM] = {2, 4, 4, 4};
+
+#define CONV_S16(x)	(x)
+#define CONV_S32(x)	((int32_t)(x) << 16)
+#define CONV_S24(x)	((int32_t)(x) << 8)
+#define CONV_FLOAT(x)	((x)*(1.0f/32768))
+
+#define WRITERS(fmt, type) \
+static void fmt##Mono(void *dst, int16_t *src, int n, int channels) { \
+  type *d = dst; \
+  int i; \
+ \
+  for (i=0; i<n; ++i) \
+    d[i] = CONV_##fmt(src[i]); \
+} \
+ \
+static void fmt##Stereo(void *dst, int16_t *src, int n, int channels) { \
+  type *d = dst, s; \
+  int i; \
+ \
+  for (i=0; i<n; ++i) { \
+    s = CONV_##fmt(src[i]); \
+    d[2*i] = d[2*i+1] = s; \
+  } \
+} \
+ \
+static void fmt##Multi(void *dst, int16_t *src, int n, int channels) { \
+  type *d = dst, s; \
+  int i, c; \
+ \
+  for (i=0; i<n; ++i) { \
+    s = CONV_##fmt(src[i]); \
+    for (c=0; c<channels; ++c) \
+      *d++ = s; \
+  } \
+}
+
+WRITERS(S16, int16_t)
+WRITERS(S32, int32_t)
+WRITERS(S24, int32_t)
+WRITERS(FLOAT, float)
+
+static pcmWriter *writers[NPCM][3] = {
+  {S16Mono, S16Stereo, S16Multi},
+  {S32Mono, S32Stereo, S32Multi},
+  {S24Mono, S24Stereo, S24Multi},
+  {FLOATMono, FLOATStereo, FLOATMulti},
+};
+
+pcmWriter *findWriter(int format, int channels) {
+  return writers[format][channels > 2 ? 2 : channels-1];
+}
@@ -0,0 +1,17 @@
+// sample formats devices take natively, filled from the mixed block
+// copyright simulistics ltd
+
+// formats, in the order we ask devices for them
+#define PCM_S16		0
+#define PCM_S32		1
+#define PCM_S24		2 // low 3 bytes of 4
+#define PCM_FLOAT	3
+#define NPCM		4
+
+// n mono frames out to every channel of an interleaved device buffer
+typedef void pcmWriter(void *dst, int16_t *src, int n, int channels);
+
+extern char *pcmNames[NPCM];
+extern int pcmBytes[NPCM];
+
+pcmWriter *findWriter(int format, int channels);
@@ -0,0 +1,199 @@
+// real-time profile: priority and core for each kind of thread
+// copyright simulistics ltd
+// every thread that has to keep time starts here, takes its role's
+// priority and core, and touches its stack so it won't fault later;
+// jitter mode runs a timer thread per role to see what it would get
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <alloca.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "rt.h"
+#include "trace.h"
+
+struct rtRole rtRoles[NROLES] = {
+  {"audio", 89, -1, 5805000}, // default period, 256 frames
+  {"helper", 89, -1, 5805000},
+  {"capture", 79, -1, 5000000},
+  {"sense", 79, -1, 1000000},
+  {"control", 0, -1, 2000000}
+};
+int rtLock = 1;
+
+// comma separated: role=prio[@cpu], lock or nolock
+int rtProfile(char *spec) {
+  char *tok, *save, *eq;
+  int i, prio, cpu;
+
+  for (tok = strtok_r(spec, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (!strcmp(tok, "lock") || !strcmp(tok, "nolock")) {
+      rtLock = tok[0] == 'l';
+      continue;
+    }
+    cpu = -1;
+    if (!(eq = strchr(tok, '=')) || sscanf(eq+1, "%d@%d", &prio, &cpu) < 1)
+      break;
+    for (i=0; i<NROLES; ++i)
+      if (strlen(rtRoles[i].name) == eq-tok &&
+	  !strncmp(tok, rtRoles[i].name, eq-tok))
+	break;
+    if (i == NROLES || prio < 0 || prio > sched_get_priority_max(SCHED_FIFO))
+      break;
+    rtRoles[i].prio = prio;
+    rtRoles[i].cpu = cpu;
+  }
+  if (!tok)
+    return 1;
+  fprintf(stderr, "Bad real-time profile at %s, try eg audio=89@3,sense=79@2"
+	  ",nolock\n", tok);
+  return 0;
+}
+
+// whole process, before threads start
+void rtStart() {
+  if (rtLock && mlockall(MCL_CURRENT|MCL_FUTURE) < 0)
+    perror("Memory not locked");
+}
+
+// calling thread takes on role
+void rtSelf(int role) {
+  struct rtRole *r = rtRoles + role;
+  struct sched_param param;
+  cpu_set_t cpus;
+  char *stack;
+
+  if (r->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(r->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+      fprintf(stderr, "Can't pin %s to core %d\n", r->name, r->cpu);
+  }
+  if (r->prio) {
+    param.sched_priority = r->prio;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+      fprintf(stderr, "No real-time priority for %s\n", r->name);
+  }
+  TRACE_THREAD(r->name);
+  stack = alloca(RT_PREFAULT);
+  memset(stack, 0, RT_PREFAULT);
+  __asm__ volatile("" : : "r"(stack) : "memory"); // keep the memset
+}
+
+#define MAX_THREADS	64
+
+static struct start {
+  int role;
+  void* (*fn)(void*);
+  void *arg;
+} starts[MAX_THREADS];
+static int nStarts = 0;
+
+static void* startLoop(void* arg) {
+  struct start *s = arg;
+
+  rtSelf(s->role);
+  return s->fn(s->arg);
+}
+
+// threads live for good, so their start records can too
+void startThread(int role, void* (*fn)(void*), void *arg) {
+  pthread_t threadId;
+  pthread_attr_t attr;
+  int n = __atomic_fetch_add(&nStarts, 1, __ATOMIC_RELAXED);
+  struct start *s = starts + n;
+
+  if (n >= MAX_THREADS) {
+    fprintf(stderr, "Too many threads for %s\n", rtRoles[role].name);
+    exit(EXIT_FAILURE);
+  }
+  s->role = role;
+  s->fn = fn;
+  s->arg = arg;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, RT_STACK);
+  if (pthread_create(&threadId, &attr, startLoop, s)) {
+    perror(rtRoles[role].name);
+    exit(EXIT_FAILURE);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+//// jitter mode: how late each role wakes from a timer, as cyclictest
+static struct probe {
+  int role;
+  double secs;
+  uint32_t lateUs[JIT_BUCKETS];
+  long wakeups, maxUs;
+} probes[NROLES];
+static sem_t probesDone;
+
+static void* probeLoop(void* arg) {
+  struct probe *p = arg;
+  struct timespec next, now;
+  long late, n, periodNs = rtRoles[p->role].periodNs;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (n = p->secs*1e9/periodNs; n > 0; --n) {
+    if ((next.tv_nsec += periodNs) >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      ++next.tv_sec;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+	   == EINTR)
+      ;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = ((now.tv_sec-next.tv_sec)*1000000000 + now.tv_nsec-next.tv_nsec)
+      / 1000;
+    ++p->lateUs[late < JIT_BUCKETS ? late : JIT_BUCKETS-1];
+    if (late > p->maxUs) p->maxUs = late;
+    ++p->wakeups;
+  }
+  sem_post(&probesDone);
+  return NULL;
+}
+
+// lateness below which given fraction of wakeups came, in us
+static long percentile(struct probe *p, double frac) {
+  long i, sum = 0;
+
+  for (i=0; i<JIT_BUCKETS-1; ++i)
+    if ((sum += p->lateUs[i]) >= frac*p->wakeups)
+      break;
+  return i+1;
+}
+
+// every role at once, so they contend as they would when playing
+void rtJitter(double secs) {
+  struct probe *p;
+  int i;
+
+  sem_init(&probesDone, 0, 0);
+  for (i=0; i<NROLES; ++i) {
+    probes[i].role = i;
+    probes[i].secs = secs;
+    startThread(i, probeLoop, probes+i);
+  }
+  for (i=0; i<NROLES; ++i)
+    while (sem_wait(&probesDone))
+      ;
+  printf("thread   prio  cpu  period us  wakeups  p50 us  p99 us  p99.9 us"
+	 "  max us\n");
+  for (i=0; i<NROLES; ++i) {
+    p = probes + i;
+    printf("%-8s %4d  %3d  %9ld  %7ld  %6ld  %6ld  %8ld  %6ld\n",
+	   rtRoles[i].name, rtRoles[i].prio, rtRoles[i].cpu,
+	   rtRoles[i].periodNs/1000, p->wakeups, percentile(p, 0.5),
+	   percentile(p, 0.99), percentile(p, 0.999), p->maxUs);
+  }
+}
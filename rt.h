@@ -0,0 +1,30 @@
+// real-time profile: priority and core for each kind of thread
+// copyright simulistics ltd
+
+// thread roles
+#define RT_AUDIO	0 // render thread
+#define RT_HELPER	1 // renders some voices for it
+#define RT_CAPTURE	2 // SPI capture
+#define RT_SENSE	3 // turns edges or captures into IFs
+#define RT_CONTROL	4 // main loop, readings to synth targets
+#define NROLES		5
+
+#define RT_STACK	(256*1024) // for threads we start
+#define RT_PREFAULT	(64*1024) // of stack touched before work starts
+#define JIT_BUCKETS	10000 // 1us each, last also counts anything later
+
+struct rtRole {
+  char *name;
+  int prio; // SCHED_FIFO priority, 0 for ordinary
+  int cpu; // core to pin to, -1 for any
+  long periodNs; // usual time between wakeups, for jitter mode
+};
+
+extern struct rtRole rtRoles[NROLES];
+extern int rtLock; // mlockall before playing
+
+int rtProfile(char *spec);
+void rtStart();
+void startThread(int role, void* (*fn)(void*), void *arg);
+void rtSelf(int role);
+void rtJitter(double secs);
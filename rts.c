@@ -0,0 +1,171 @@
+// replay of recorded IFs, stands in for sensing hardware
+// copyright simulistics ltd
+// record with: mts -w file, replay with: rmts -r file [-r file]... [-f]
+// each instrument in each recording plays as its own antenna pair,
+// at the times its readings were sensed
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sense.h"
+#include "snap.h"
+#include "iflog.h"
+#include "rt.h"
+#include "trace.h"
+
+static struct replay {
+  struct ifRecord *recs; // whole recording, all instruments
+  size_t nRecs, first, mine; // first and how many are for inst
+  uint64_t origin; // usec of the recording's first reading
+  int inst; // recorded instrument it plays
+  int n; // antenna pair it plays as
+  unsigned int version; // of the reading last published
+} replays[MAX_INST];
+static int nPairs = 0;
+
+static volatile sig_atomic_t stopReq = 0;
+static atomic_int ending = 0;
+
+// Ctrl-C or kill: replay threads see it and end the process themselves,
+// so exit handlers such as finishing a WAV file run as normal
+static void sig_handler(int signo) {
+  stopReq = 1;
+}
+
+// first replay to end takes the process with it, any other just stops
+static void finished(struct replay *r, size_t done) {
+  if (atomic_exchange(&ending, 1))
+    pthread_exit(NULL);
+  fprintf(stderr, "Replayed %zu of %zu readings\n", done, r->mine);
+  exit(0);
+}
+
+static unsigned int publish(struct replay *r, size_t i) {
+  struct timespec stamps[2];
+  double ifs[2];
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, stamps);
+  stamps[1] = stamps[0];
+  ifs[0] = r->recs[i].p;
+  ifs[1] = r->recs[i].v;
+  return snapPublish(r->n, 3, ifs, stamps);
+}
+
+// move through records at the time they were made, or as fast as the
+// control loop takes them
+static void* replayLoop(void* arg) {
+  struct replay *r = arg;
+  struct timespec start, tv;
+  uint64_t usec;
+  size_t i, done = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i=r->first+1; i<r->nRecs; ++i) {
+    if (r->recs[i].inst != r->inst)
+      continue;
+    if (replayFast) {
+      tv.tv_sec = 0;
+      tv.tv_nsec = 20000;
+      while (snapTaken(r->n) != r->version && !stopReq)
+	nanosleep(&tv, NULL);
+    } else {
+      usec = r->recs[i].usec > r->origin ? r->recs[i].usec - r->origin : 0;
+      tv.tv_sec = start.tv_sec + usec/1000000;
+      tv.tv_nsec = start.tv_nsec + (usec%1000000)*1000;
+      if (tv.tv_nsec >= 1000000000) {
+	tv.tv_nsec -= 1000000000;
+	++tv.tv_sec;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tv, NULL);
+    }
+    if (stopReq)
+      break;
+    TRACE_MARK("replay");
+    r->version = publish(r, i);
+    ++done;
+  }
+  finished(r, done);
+  return NULL;
+}
+
+// a pair for each instrument the recording has readings for
+static void openReplay(char *fileName) {
+  struct stat st;
+  struct ifHeader *hdr;
+  struct ifRecord *recs;
+  struct replay *r;
+  size_t nRecs, i;
+  int fd, k, n0 = nPairs;
+
+  if ((fd = open(fileName, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(fileName);
+    exit(EXIT_FAILURE);
+  }
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (hdr == MAP_FAILED || st.st_size < sizeof(*hdr) ||
+      memcmp(hdr->magic, IFLOG_MAGIC, sizeof(hdr->magic))) {
+    fprintf(stderr, "%s is not an IF recording\n", fileName);
+    exit(EXIT_FAILURE);
+  }
+  if (hdr->version != IFLOG_VERSION) {
+    fprintf(stderr, "%s is a version %u recording, need %d\n", fileName,
+	    hdr->version, IFLOG_VERSION);
+    exit(EXIT_FAILURE);
+  }
+  recs = (struct ifRecord*)(hdr+1);
+  nRecs = (st.st_size-sizeof(*hdr))/sizeof(*recs);
+  for (i=0; i<nRecs; ++i) {
+    for (k=n0; k<nPairs && replays[k].inst != recs[i].inst; ++k) ;
+    if (k < nPairs) {
+      ++replays[k].mine;
+      continue;
+    }
+    if (nPairs == MAX_INST) {
+      fprintf(stderr, "%s: at most %d instruments in all\n", fileName,
+	      MAX_INST);
+      exit(EXIT_FAILURE);
+    }
+    r = replays + nPairs;
+    r->recs = recs;
+    r->nRecs = nRecs;
+    r->first = i;
+    r->mine = 1;
+    r->origin = recs[0].usec;
+    r->inst = recs[i].inst;
+    r->n = nPairs++;
+  }
+  if (nPairs == n0) {
+    fprintf(stderr, "%s has no readings to replay\n", fileName);
+    exit(0);
+  }
+}
+
+int setupSensing() {
+  int n;
+
+  if (!nReplays) {
+    fprintf(stderr, "Need a recording to replay (-r file)\n");
+    exit(EXIT_FAILURE);
+  }
+  signal(SIGINT, sig_handler);
+  signal(SIGTERM, sig_handler);
+  signal(SIGHUP, sig_handler);
+  for (n=0; n<nReplays; ++n)
+    openReplay(replayFiles[n]);
+  for (n=0; n<nPairs; ++n) // first readings there for the baseline
+    replays[n].version = publish(replays+n, replays[n].first);
+  for (n=0; n<nPairs; ++n)
+    startThread(RT_SENSE, replayLoop, replays+n);
+  return nPairs;
+}
@@ -0,0 +1,75 @@
+// finding edges in SPI capture of IF signal
+// copyright simulistics ltd
+
+#include <stdint.h>
+#include <string.h>
+#include <byteswap.h>
+
+#include "scan.h"
+
+// when using spi1, phase reverses every 24 bits:
+// inverting masks for 32-bit words cycle every 3 words
+static const uint32_t masks[3] = {0x000000ff, 0xffff0000, 0x00ffffff};
+// same pattern for 64-bit words, also repeats every 3
+static const uint64_t masks64[3] = {
+  (uint64_t)0x000000ff<<32 | 0xffff0000,
+  (uint64_t)0x00ffffff<<32 | 0x000000ff,
+  (uint64_t)0xffff0000<<32 | 0x00ffffff
+};
+
+// return posn of 1st bit in buffer of len bytes >= toChk not current
+int find_transition(int side, unsigned char bufr[], int len, int toChk,
+		    int current) {
+  int wrd, bit;
+  uint32_t slot;
+
+  while (toChk < 8*len) {
+    wrd = toChk/32;
+
+    slot = __bswap_32(((uint32_t*)bufr)[wrd]) ^ -current;
+    if (side) {
+      slot ^= masks[wrd%3]; // when using spi1, phase reverses every 24 bits
+    }
+    slot <<= toChk%32;
+    if (slot) { // rest of word not all current value (clz(0) undefined)
+      bit = __builtin_clz(slot);
+      return toChk+bit;
+    }
+    toChk = 32*(wrd+1);
+  }
+  return 0; // transition not found in remainder of buffer
+}
+
+// list posns of every bit differing from the one before, in one pass
+// 64 bits at a time, len a multiple of SPI_STEP; returns number found
+int scanTransitions(int side, unsigned char bufr[], int len, int *posns) {
+  uint64_t wrd, diff, prev;
+  int w, n = 0, bit;
+
+  prev = bufr[0] >> 7; // first bit has nothing before it
+  for (w=0; w<len/8; ++w) {
+    memcpy(&wrd, bufr+8*w, 8);
+    wrd = __bswap_64(wrd); // first bit now top
+    if (side)
+      wrd ^= masks64[w%3];
+    diff = wrd ^ (wrd>>1 | prev<<63); // each bit vs one before
+    prev = wrd & 1;
+    while (diff) {
+      bit = __builtin_clzll(diff);
+      posns[n++] = 64*w + bit;
+      diff ^= (uint64_t)1<<63 >> bit;
+    }
+  }
+  return n;
+}
+
+// as find_transition, but using list from scanTransitions:
+// first is bit 0 of buffer, *j keeps place in list as toChk increases
+int next_transition(int *posns, int n, int len, int *j, int first,
+		    int toChk, int current) {
+  if (toChk >= 8*len) return 0;
+  while (*j<n && posns[*j] <= toChk) ++*j;
+  if ((first ^ (*j&1)) != current) // bit at toChk already differs
+    return toChk;
+  return *j<n ? posns[*j] : 0;
+}
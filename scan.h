@@ -0,0 +1,13 @@
+// finding edges in SPI capture of IF signal
+// copyright simulistics ltd
+
+#define SPI_BUF 1024 // longest capture, bytes
+#define SPI_MIN 64 // shortest
+#define SPI_STEP 8 // captures are a whole number of these
+#define FASTCLK 200000000
+
+int find_transition(int side, unsigned char bufr[], int len, int toChk,
+		    int current);
+int scanTransitions(int side, unsigned char bufr[], int len, int *posns);
+int next_transition(int *posns, int n, int len, int *j, int first,
+		    int toChk, int current);
@@ -0,0 +1,10 @@
+// interface each sensing backend provides to the player
+// copyright simulistics ltd
+
+// needs time.h
+
+#define MAX_INST	8 // antenna pairs one player can handle
+
+int setupSensing(); // returns number of antenna pairs
+// readings go out through snapPublish in snap.h
+void getIFs(int n, int *p, int *v); // pitch and volume IFs of pair n
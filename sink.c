@@ -0,0 +1,343 @@
+// places rendered audio can go
+// copyright simulistics ltd
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <alsa/asoundlib.h>
+
+#include "synth.h"
+#include "fx.h"
+#include "audio.h"
+#include "stats.h"
+#include "pcm.h"
+
+//// ALSA device, the normal case
+// periods and buffer set explicitly, rendering straight into the
+// device ring if it can be mmapped, else through a staging buffer;
+// format and channels are whatever the device takes natively, filled
+// from the staging buffer by a writer made for them, so the plug layer
+// has nothing to convert
+static snd_pcm_t *handle;
+static int mmapped;
+static snd_pcm_uframes_t mmapOffset;
+static int16_t staging[MAX_BLOCK];
+static pcmWriter *writer; // NULL if device takes 16-bit mono as is
+static int channels;
+static void *mmapArea, *converted;
+
+static const snd_pcm_format_t alsaFormats[NPCM] = {
+  SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_LE,
+  SND_PCM_FORMAT_FLOAT_LE
+};
+
+static int alsaFail(char *what, int err) {
+  fprintf(stderr, "Playback %s error: %s\n", what, snd_strerror(err));
+  return 0;
+}
+
+// native asks for the device's own format and channels, and its rate
+// if that is PCM_RATE; otherwise 16-bit mono and ALSA converts
+static int pcmOpen(char *dev, int native) {
+  snd_pcm_hw_params_t *hw;
+  snd_pcm_sw_params_t *sw;
+  snd_pcm_uframes_t frames, bufSize, start;
+  unsigned int rate = PCM_RATE, periods = nPeriods, ch = 1;
+  int err, format = PCM_S16;
+
+  if ((err = snd_pcm_open(&handle, dev?dev:"default",
+			  SND_PCM_STREAM_PLAYBACK, native ?
+			  SND_PCM_NO_AUTO_RESAMPLE | SND_PCM_NO_AUTO_FORMAT |
+			  SND_PCM_NO_AUTO_CHANNELS : 0)) < 0)
+    return alsaFail("open", err);
+
+  snd_pcm_hw_params_alloca(&hw);
+  if ((err = snd_pcm_hw_params_any(handle, hw)) < 0)
+    return alsaFail("hw params", err);
+  mmapped = snd_pcm_hw_params_set_access(handle, hw,
+		       SND_PCM_ACCESS_MMAP_INTERLEAVED) >= 0;
+  if (!mmapped &&
+      (err = snd_pcm_hw_params_set_access(handle, hw,
+		       SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+    return alsaFail("access", err);
+  if (native)
+    for (; format<NPCM; ++format)
+      if (snd_pcm_hw_params_test_format(handle, hw,
+					alsaFormats[format]) >= 0)
+	break;
+  if (format == NPCM) {
+    fprintf(stderr, "Device takes none of our sample formats\n");
+    return 0;
+  }
+  if ((err = snd_pcm_hw_params_set_format(handle, hw,
+					  alsaFormats[format])) < 0)
+    return alsaFail("format", err);
+  if ((err = snd_pcm_hw_params_set_channels_near(handle, hw, &ch)) < 0)
+    return alsaFail("channels", err);
+  if ((err = snd_pcm_hw_params_set_rate_near(handle, hw, &rate, 0)) < 0)
+    return alsaFail("rate", err);
+  if (rate != PCM_RATE) {
+    if (native) {
+      fprintf(stderr, "Device runs at %u Hz, resampling from %d; "
+	      "build with -DPCM_RATE=%u to save the work\n",
+	      rate, PCM_RATE, rate);
+      snd_pcm_close(handle);
+      return pcmOpen(dev, 0);
+    }
+    fprintf(stderr, "Device plays at %u Hz, not %d\n", rate, PCM_RATE);
+    return 0;
+  }
+  frames = period;
+  if ((err = snd_pcm_hw_params_set_period_size_near(handle, hw,
+						    &frames, 0)) < 0)
+    return alsaFail("period size", err);
+  if ((err = snd_pcm_hw_params_set_periods_near(handle, hw,
+						&periods, 0)) < 0)
+    return alsaFail("periods", err);
+  if ((err = snd_pcm_hw_params(handle, hw)) < 0)
+    return alsaFail("hw params", err);
+  snd_pcm_hw_params_get_period_size(hw, &frames, 0);
+  snd_pcm_hw_params_get_buffer_size(hw, &bufSize);
+  if (frames > MAX_BLOCK) {
+    fprintf(stderr, "Device period %lu longer than %d\n", frames, MAX_BLOCK);
+    return 0;
+  }
+  period = frames; // what the device gave us
+  nPeriods = bufSize/frames;
+  channels = ch;
+  writer = format == PCM_S16 && ch == 1 ? NULL : findWriter(format, ch);
+  if (writer && !mmapped &&
+      !(converted = malloc(MAX_BLOCK*ch*pcmBytes[format]))) {
+    fprintf(stderr, "No memory for converted samples\n");
+    return 0;
+  }
+
+  // wake us for each period, start playing once buffer is full, or
+  // holds the fill level being kept
+  start = bufSize;
+  if (fillTarget) {
+    if (fillTarget + period > bufSize) { // not what -F asked for
+      fprintf(stderr, "Warning: -F %.1fms not applied, a %.1fms buffer"
+	      " with a %.1fms period only holds %.1fms; try more periods"
+	      " (-P)\n", 1000.0*fillTarget/PCM_RATE, 1000.0*bufSize/PCM_RATE,
+	      1000.0*period/PCM_RATE, 1000.0*(bufSize - period)/PCM_RATE);
+      fillTarget = bufSize - period;
+    }
+    start = fillTarget + period;
+  }
+  snd_pcm_sw_params_alloca(&sw);
+  if ((err = snd_pcm_sw_params_current(handle, sw)) < 0 ||
+      (err = snd_pcm_sw_params_set_avail_min(handle, sw, period)) < 0 ||
+      (err = snd_pcm_sw_params_set_start_threshold(handle, sw,
+						   start)) < 0 ||
+      (err = snd_pcm_sw_params(handle, sw)) < 0)
+    return alsaFail("sw params", err);
+
+  fprintf(stderr, "Playing %d periods of %d frames, %.1lfms, %s, "
+	  "%s x%d\n", nPeriods, period, 1000.0*bufSize/PCM_RATE,
+	  mmapped ? "mmapped" : "copied", pcmNames[format], channels);
+  return 1;
+}
+
+static int alsaOpen(char *dev) {
+  return pcmOpen(dev, 1);
+}
+
+static int plugOpen(char *dev) { // as before, for comparison
+  return pcmOpen(dev, 0);
+}
+
+// count xruns, return 0 if beyond recovery
+static int alsaRecover(char *what, int err) {
+  if (err == -EPIPE)
+    ++stats->xruns;
+  if ((err = snd_pcm_recover(handle, err, 0)) < 0) {
+    fprintf(stderr, "%s failed: %s\n", what, snd_strerror(err));
+    return 0;
+  }
+  return 1;
+}
+
+static int alsaWrite(int16_t *buffer, int n) {
+  snd_pcm_sframes_t frames;
+
+  if (writer)
+    writer(converted, buffer, n, channels);
+  frames = snd_pcm_writei(handle, writer ? converted : buffer, n);
+  if (frames < 0)
+    return alsaRecover("snd_pcm_writei", frames) ? 0 : -1;
+  if (frames < n) {
+    ++stats->shortWrites;
+    fprintf(stderr, "Short write (expected %i, wrote %li)\n", n, frames);
+  }
+  return frames;
+}
+
+// room for up to *n frames in device ring, waiting till a period is free;
+// staging if the device format needs a writer to fill the ring
+static int16_t *alsaBegin(int *n) {
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t frames;
+  snd_pcm_sframes_t avail;
+  int err;
+
+  if (!mmapped)
+    return staging;
+  for (;;) {
+    if ((avail = snd_pcm_avail_update(handle)) < 0) {
+      if (!alsaRecover("snd_pcm_avail_update", avail)) return NULL;
+    } else if (avail >= *n)
+      break;
+    else if ((err = snd_pcm_wait(handle, 1000)) < 0 &&
+	     !alsaRecover("snd_pcm_wait", err))
+      return NULL;
+  }
+  frames = *n;
+  if ((err = snd_pcm_mmap_begin(handle, &areas, &mmapOffset, &frames)) < 0) {
+    alsaRecover("snd_pcm_mmap_begin", err);
+    return NULL;
+  }
+  *n = frames; // less if ring wraps
+  mmapArea = (char*)areas->addr + areas->first/8 + mmapOffset*areas->step/8;
+  return writer ? staging : mmapArea;
+}
+
+static int alsaCommit(int n) {
+  snd_pcm_sframes_t frames;
+
+  if (!mmapped)
+    return alsaWrite(staging, n);
+  if (writer)
+    writer(mmapArea, staging, n, channels);
+  frames = snd_pcm_mmap_commit(handle, mmapOffset, n);
+  if (frames < 0)
+    return alsaRecover("snd_pcm_mmap_commit", frames) ? 0 : -1;
+  if (frames < n)
+    ++stats->shortWrites;
+  return frames;
+}
+
+// frames written but not yet heard
+static long alsaDelay() {
+  snd_pcm_sframes_t frames;
+
+  return snd_pcm_delay(handle, &frames) < 0 ? 0 : frames;
+}
+
+static void alsaClose() {
+  snd_pcm_close(handle);
+}
+
+//// WAV file, 16-bit mono
+// the render thread may still be writing when the process exits and
+// atexit closes the file, so both hold the lock and writes after the
+// close go nowhere
+static FILE *wavStm;
+static uint32_t wavFrames;
+static pthread_mutex_t wavLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void wavHeader() {
+  uint32_t dataSiz = 2*wavFrames, rate = PCM_RATE, u32;
+  uint16_t u16;
+
+#define PUT(v, x) (v = (x), fwrite(&v, sizeof(v), 1, wavStm))
+  fwrite("RIFF", 4, 1, wavStm);
+  PUT(u32, 36 + dataSiz);
+  fwrite("WAVEfmt ", 8, 1, wavStm);
+  PUT(u32, 16); // fmt chunk size
+  PUT(u16, 1); // PCM
+  PUT(u16, 1); // channels
+  PUT(u32, rate);
+  PUT(u32, 2*rate); // bytes/sec
+  PUT(u16, 2); // bytes/frame
+  PUT(u16, 16); // bits/sample
+  fwrite("data", 4, 1, wavStm);
+  PUT(u32, dataSiz);
+#undef PUT
+}
+
+static int wavOpen(char *name) {
+  if (!name) {
+    fprintf(stderr, "WAV output needs a file name (-o wav:file)\n");
+    return 0;
+  }
+  if (!(wavStm = fopen(name, "wb"))) {
+    perror(name);
+    return 0;
+  }
+  wavFrames = 0;
+  wavHeader(); // sizes filled in at close
+  return 1;
+}
+
+static int wavWrite(int16_t *buffer, int n) {
+  pthread_mutex_lock(&wavLock);
+  if (wavStm) {
+    n = fwrite(buffer, 2, n, wavStm);
+    wavFrames += n;
+  } else
+    n = 0;
+  pthread_mutex_unlock(&wavLock);
+  return n;
+}
+
+static void wavClose() {
+  pthread_mutex_lock(&wavLock);
+  rewind(wavStm);
+  wavHeader();
+  fclose(wavStm);
+  wavStm = NULL;
+  pthread_mutex_unlock(&wavLock);
+}
+
+//// nowhere, for timing the rest
+static int nullOpen(char *arg) {
+  return 1;
+}
+
+static int nullWrite(int16_t *buffer, int n) {
+  return n;
+}
+
+static long noDelay() { // heard as soon as written
+  return 0;
+}
+
+static void nullClose() {
+}
+
+static struct sink sinks[] = {
+  {"alsa", alsaOpen, alsaWrite, alsaBegin, alsaCommit, alsaDelay, alsaClose},
+  {"plug", plugOpen, alsaWrite, alsaBegin, alsaCommit, alsaDelay, alsaClose},
+  {"wav", wavOpen, wavWrite, NULL, NULL, noDelay, wavClose},
+  {"null", nullOpen, nullWrite, NULL, NULL, noDelay, nullClose},
+};
+
+struct sink *sink = NULL;
+
+static void closeSink() {
+  sink->close();
+}
+
+// spec is name[:arg], eg alsa:hw:0 or wav:out.wav
+int openSink(char *spec) {
+  char *arg;
+  int i, len;
+
+  arg = strchr(spec, ':');
+  len = arg ? arg++ - spec : strlen(spec);
+  for (i=0; i<sizeof(sinks)/sizeof(*sinks); ++i)
+    if (strlen(sinks[i].name) == len && !strncmp(spec, sinks[i].name, len)) {
+      if (!sinks[i].open(arg)) return 0;
+      sink = sinks + i;
+      atexit(closeSink);
+      return 1;
+    }
+  fprintf(stderr, "Unknown output %s, try alsa, plug, wav or null\n", spec);
+  return 0;
+}
@@ -0,0 +1,107 @@
+// newest IFs from each antenna pair, as the sensing backends publish them
+// copyright simulistics ltd
+// each side of each pair is a seqlock with one writer, so readers never
+// block it; a futex wakes the control loop as soon as anything lands,
+// with no system call at all if nobody is waiting
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "sense.h"
+#include "snap.h"
+
+static struct pair {
+  struct side {
+    atomic_uint seq; // odd while being written
+    double freq;
+    struct timespec stamp;
+  } sides[2];
+  atomic_uint version, taken;
+} pairs[MAX_INST];
+
+static atomic_uint events, waiters;
+
+unsigned int snapPublish(int n, int sides, double *ifs,
+			 struct timespec *stamps) {
+  struct pair *p = pairs + n;
+  struct side *sd;
+  unsigned int seq, version;
+  int s;
+
+  for (s=0; s<2; ++s)
+    if (sides & 1<<s) {
+      sd = p->sides + s;
+      seq = atomic_load_explicit(&sd->seq, memory_order_relaxed);
+      atomic_store_explicit(&sd->seq, seq+1, memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+      sd->freq = ifs[s];
+      sd->stamp = stamps[s];
+      atomic_store_explicit(&sd->seq, seq+2, memory_order_release);
+    }
+  version = atomic_fetch_add_explicit(&p->version, 1,
+				      memory_order_release) + 1;
+  atomic_fetch_add(&events, 1);
+  if (atomic_load(&waiters))
+    syscall(SYS_futex, &events, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  return version;
+}
+
+static void readSide(struct side *sd, double *freq, struct timespec *stamp) {
+  unsigned int seq;
+
+  do {
+    seq = atomic_load_explicit(&sd->seq, memory_order_acquire);
+    *freq = sd->freq;
+    *stamp = sd->stamp;
+    atomic_thread_fence(memory_order_acquire);
+  } while (seq&1 || seq != atomic_load_explicit(&sd->seq,
+						memory_order_relaxed));
+}
+
+// version first, so the sides are at least as new as it says
+void getSnap(int n, struct ifSnap *s) {
+  struct pair *p = pairs + n;
+  struct timespec vt;
+
+  s->version = atomic_load_explicit(&p->version, memory_order_acquire);
+  readSide(p->sides, s->ifs, &s->stamp);
+  readSide(p->sides+1, s->ifs+1, &vt);
+  if (vt.tv_sec > s->stamp.tv_sec ||
+      (vt.tv_sec == s->stamp.tv_sec && vt.tv_nsec > s->stamp.tv_nsec))
+    s->stamp = vt;
+  atomic_store_explicit(&p->taken, s->version, memory_order_release);
+}
+
+void getIFs(int n, int *p, int *v) {
+  struct ifSnap s;
+
+  getSnap(n, &s);
+  *p = s.ifs[0];
+  *v = s.ifs[1];
+}
+
+unsigned int snapTaken(int n) {
+  return atomic_load_explicit(&pairs[n].taken, memory_order_acquire);
+}
+
+unsigned int snapEvents() {
+  return atomic_load(&events);
+}
+
+// returns once events differs from seen, or on timeout
+unsigned int snapWait(unsigned int seen, long timeoutNs) {
+  struct timespec tv;
+
+  tv.tv_sec = timeoutNs/1000000000;
+  tv.tv_nsec = timeoutNs%1000000000;
+  atomic_fetch_add(&waiters, 1); // publisher sees this or we see its event
+  if (atomic_load(&events) == seen)
+    syscall(SYS_futex, &events, FUTEX_WAIT_PRIVATE, seen, &tv, NULL, 0);
+  atomic_fetch_sub(&waiters, 1);
+  return atomic_load(&events);
+}
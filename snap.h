@@ -0,0 +1,18 @@
+// newest IFs from each antenna pair, as the sensing backends publish them
+// copyright simulistics ltd
+
+// needs time.h
+
+struct ifSnap { // consistent copy for the control loop
+  unsigned int version; // goes up with each new reading
+  double ifs[2]; // pitch and volume, Hz
+  struct timespec stamp; // CLOCK_MONOTONIC_RAW of newest reading in it
+};
+
+// sides is a mask, 1 for pitch and 2 for volume; returns new version
+unsigned int snapPublish(int n, int sides, double *ifs,
+			 struct timespec *stamps);
+void getSnap(int n, struct ifSnap *s);
+unsigned int snapTaken(int n); // version getSnap last gave out
+unsigned int snapEvents(); // changes whenever any pair publishes
+unsigned int snapWait(unsigned int seen, long timeoutNs);
@@ -0,0 +1,177 @@
+// SPI capture for ultrasimple sensing
+// copyright simulistics ltd
+// device kept open, buffers captured by their own thread so the
+// next capture overlaps decoding of the last
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#include "scan.h"
+#include "spi.h"
+#include "rt.h"
+#include "trace.h"
+
+static int realOpen(const char *path, int flags) {
+  return open(path, flags);
+}
+
+static int realIoctl(int fd, unsigned long req, void *arg) {
+  return ioctl(fd, req, arg);
+}
+
+struct spiOps realSpi = {realOpen, realIoctl, close}, *spiOps = &realSpi;
+volatile unsigned long spiCalls = 0;
+
+// side selects module not chip, as in our copy of wiringPiSPI
+static const char *spiDevs[2] = {"/dev/spidev0.0", "/dev/spidev1.0"};
+
+static struct capture {
+  int fd, speed;
+  volatile int *rate; // clock divider wanted, may change any time
+  volatile int *len; // and capture length, bytes
+  unsigned char bufs[CAP_BUFS][SPI_BUF];
+  struct timespec stamps[CAP_BUFS];
+  int rates[CAP_BUFS], lens[CAP_BUFS]; // how each buffer was captured
+  sem_t free, full;
+  int head, tail;
+} caps[2];
+
+static void spiFail(char *what, int side) {
+  fprintf(stderr, "SPI %s failure on %s: %s\n", what, spiDevs[side],
+	  strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+static void setSpeed(struct capture *c, int side, int speed) {
+  uint32_t hz = speed;
+
+  ++spiCalls;
+  if (spiOps->ioctl(c->fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0)
+    spiFail("speed change", side);
+  c->speed = speed;
+}
+
+// open once for good, mode 0 and 8 bits per word
+int spiOpen(int side, int speed) {
+  struct capture *c = caps + side;
+  uint8_t mode = 0, bpw = 8;
+
+  spiCalls += 3;
+  if ((c->fd = spiOps->open(spiDevs[side], O_RDWR)) < 0)
+    spiFail("open", side);
+  if (spiOps->ioctl(c->fd, SPI_IOC_WR_MODE, &mode) < 0)
+    spiFail("mode change", side);
+  if (spiOps->ioctl(c->fd, SPI_IOC_WR_BITS_PER_WORD, &bpw) < 0)
+    spiFail("BPW change", side);
+  setSpeed(c, side, speed);
+  return c->fd;
+}
+
+static void* captureLoop(void* dump) {
+  int side = (int)(intptr_t)dump, i, slot, rate, len, res;
+  struct capture *c = caps + side;
+  struct spi_ioc_transfer xfers[CAP_BATCH];
+  struct timespec now;
+  long bufNs;
+
+  for (;;) {
+    for (i=0; i<CAP_BATCH; ++i)
+      while (sem_wait(&c->free) && errno == EINTR)
+	;
+    rate = *c->rate;
+    len = *c->len;
+    if (FASTCLK/rate != c->speed) // only touch clock when it changes
+      setSpeed(c, side, FASTCLK/rate);
+
+    memset(xfers, 0, sizeof(xfers));
+    for (i=0; i<CAP_BATCH; ++i) {
+      slot = (c->head+i)%CAP_BUFS;
+      xfers[i].tx_buf = xfers[i].rx_buf = (unsigned long)c->bufs[slot];
+      xfers[i].len = len;
+      xfers[i].speed_hz = c->speed;
+      xfers[i].bits_per_word = 8;
+    }
+    ++spiCalls;
+    TRACE_BEGIN("spi transfer");
+    res = spiOps->ioctl(c->fd, SPI_IOC_MESSAGE(CAP_BATCH), xfers);
+    TRACE_END("spi transfer");
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+    if (res < CAP_BATCH*len) {
+      printf("Only got %d bytes!\n", res);
+      for (i=0; i<CAP_BATCH; ++i)
+	sem_post(&c->free);
+      continue;
+    }
+    // batch ends now, earlier buffers ended a buffer-time apart
+    bufNs = 8e9*len/c->speed;
+    for (i=CAP_BATCH-1; i>=0; --i) {
+      slot = (c->head+i)%CAP_BUFS;
+      c->stamps[slot] = now;
+      c->rates[slot] = rate;
+      c->lens[slot] = len;
+      now.tv_nsec -= bufNs;
+      while (now.tv_nsec < 0) {
+	now.tv_nsec += 1000000000;
+	--now.tv_sec;
+      }
+    }
+    c->head = (c->head+CAP_BATCH)%CAP_BUFS;
+    for (i=0; i<CAP_BATCH; ++i)
+      sem_post(&c->full);
+  }
+  return NULL;
+}
+
+void spiStart(int side, volatile int *rate, volatile int *len) {
+  struct capture *c = caps + side;
+
+  c->rate = rate;
+  c->len = len;
+  c->head = c->tail = 0;
+  sem_init(&c->free, 0, CAP_BUFS);
+  sem_init(&c->full, 0, 0);
+  spiOpen(side, FASTCLK/ *rate);
+  startThread(RT_CAPTURE, captureLoop, (void*)(intptr_t)side);
+}
+
+// oldest captured buffer, waiting if none; hand back with spiDone
+unsigned char *spiNext(int side, struct timespec *stamp, int *rate,
+		       int *len) {
+  struct capture *c = caps + side;
+
+  while (sem_wait(&c->full) && errno == EINTR)
+    ;
+  *stamp = c->stamps[c->tail];
+  *rate = c->rates[c->tail];
+  *len = c->lens[c->tail];
+  return c->bufs[c->tail];
+}
+
+void spiDone(int side) {
+  struct capture *c = caps + side;
+
+  c->tail = (c->tail+1)%CAP_BUFS;
+  sem_post(&c->free);
+}
+
+// bytes to hold cycles of freq sampled at FASTCLK/rate, so captures are
+// no longer than the precision wanted needs; the phase reversals on
+// spi1 restart with each transfer, so any whole SPI_STEP will do
+int spiLen(double freq, int rate, int cycles) {
+  double bits = cycles*(double)FASTCLK/rate/freq;
+  int len = ((int)(bits/8) + SPI_STEP) & -SPI_STEP;
+
+  return len < SPI_MIN ? SPI_MIN : len > SPI_BUF ? SPI_BUF : len;
+}
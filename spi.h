@@ -0,0 +1,23 @@
+// SPI capture for ultrasimple sensing
+// copyright simulistics ltd
+// device kept open, buffers captured by their own thread so the
+// next capture overlaps decoding of the last
+
+#define CAP_BUFS	4 // ring of capture buffers per bus
+#define CAP_BATCH	2 // buffers captured per ioctl, divides CAP_BUFS
+
+struct spiOps { // system calls, swapped out for testing without hardware
+  int (*open)(const char *path, int flags);
+  int (*ioctl)(int fd, unsigned long req, void *arg);
+  int (*close)(int fd);
+};
+
+extern struct spiOps realSpi, *spiOps;
+extern volatile unsigned long spiCalls; // syscalls made so far
+
+int spiOpen(int side, int speed);
+void spiStart(int side, volatile int *rate, volatile int *len);
+unsigned char *spiNext(int side, struct timespec *stamp, int *rate,
+		       int *len);
+void spiDone(int side);
+int spiLen(double freq, int rate, int cycles);
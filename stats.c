@@ -0,0 +1,108 @@
+// live telemetry, in shared memory so other programs can watch it
+// copyright simulistics ltd
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "synth.h"
+#include "stats.h"
+
+static struct stats local; // if no shared memory for us
+struct stats *stats = &local;
+volatile sig_atomic_t statsReq = 0;
+
+static void statsSignal(int signo) {
+  statsReq = 1;
+}
+
+void openStats() {
+  struct stats *shared;
+  int fd;
+
+  if ((fd = shm_open(STATS_SHM, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0 ||
+      ftruncate(fd, sizeof(*stats)) < 0 ||
+      (shared = mmap(NULL, sizeof(*stats), PROT_READ|PROT_WRITE,
+		     MAP_SHARED, fd, 0)) == MAP_FAILED)
+    perror("No shared stats page " STATS_SHM);
+  else
+    stats = shared;
+  if (fd >= 0) close(fd);
+  memset(stats, 0, sizeof(*stats));
+  memcpy(stats->magic, STATS_MAGIC, sizeof(stats->magic));
+  stats->version = STATS_VERSION;
+  stats->bucketUsec = LAT_BUCKET;
+  signal(SIGUSR1, statsSignal);
+}
+
+// a block changed by a reading sensed at given time has just been
+// written, with queued frames still to play before it; a latency
+// below 0 or past LAT_LIMIT is a bad stamp, so isn't counted
+void noteLatency(struct timespec *sensed, long queued) {
+  struct timespec now;
+  long usec;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  usec = (now.tv_sec-sensed->tv_sec)*1000000 +
+    (now.tv_nsec-sensed->tv_nsec)/1000 + queued*1000000LL/PCM_RATE;
+  if (usec < 0 || usec > LAT_LIMIT)
+    return;
+  ++stats->latency[usec/LAT_BUCKET < LAT_BUCKETS ?
+		   usec/LAT_BUCKET : LAT_BUCKETS-1];
+  ++stats->readings;
+  stats->latSum += usec;
+  if (usec > stats->latMax) stats->latMax = usec;
+}
+
+// latency below which given fraction of readings were heard, in ms
+static double percentile(double frac) {
+  uint64_t sum = 0;
+  int i;
+
+  for (i=0; i<LAT_BUCKETS-1; ++i)
+    if ((sum += stats->latency[i]) >= frac*stats->readings)
+      break;
+  return (i+1)*LAT_BUCKET/1000.0;
+}
+
+void dumpStats(FILE *stm) {
+  int i;
+
+  fprintf(stm, "blocks %llu xruns %llu short writes %llu control full %llu\n",
+	  (unsigned long long)stats->blocks, (unsigned long long)stats->xruns,
+	  (unsigned long long)stats->shortWrites,
+	  (unsigned long long)stats->ctlFull);
+  if (stats->blocks)
+    fprintf(stm, "queued ms: mean %.1lf, write frames: mean %.0lf\n",
+	    1000.0*stats->queuedSum/stats->blocks/PCM_RATE,
+	    (double)stats->writeSum/stats->blocks);
+  if (stats->streamSent || stats->streamDropped || stats->streamFull)
+    fprintf(stm, "stream sent %llu dropped %llu queue full %llu\n",
+	    (unsigned long long)stats->streamSent,
+	    (unsigned long long)stats->streamDropped,
+	    (unsigned long long)stats->streamFull);
+  if (stats->fxBlocks)
+    fprintf(stm, "effects us per voice block: mean %.1lf max %.1lf\n",
+	    stats->fxNs/1000.0/stats->fxBlocks, stats->fxMaxNs/1000.0);
+  if (!stats->readings)
+    return;
+  fprintf(stm, "latency ms: mean %.1lf p50 <%.1lf p95 <%.1lf p99 <%.1lf"
+	  " max %.1lf over %llu readings\n",
+	  stats->latSum/1000.0/stats->readings, percentile(0.5),
+	  percentile(0.95), percentile(0.99), stats->latMax/1000.0,
+	  (unsigned long long)stats->readings);
+  for (i=0; i<LAT_BUCKETS; ++i)
+    if (stats->latency[i]) {
+      if (i<LAT_BUCKETS-1)
+	fprintf(stm, "  %5.1lf-%5.1lf %llu\n", i*LAT_BUCKET/1000.0,
+		(i+1)*LAT_BUCKET/1000.0, (unsigned long long)stats->latency[i]);
+      else
+	fprintf(stm, "  %5.1lf+      %llu\n", i*LAT_BUCKET/1000.0,
+		(unsigned long long)stats->latency[i]);
+    }
+}
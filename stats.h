@@ -0,0 +1,34 @@
+// live telemetry, in shared memory so other programs can watch it
+// copyright simulistics ltd
+// read with eg: od -A d -t u8 /dev/shm/mts-stats, or kill -USR1 to dump
+
+// needs signal.h and time.h
+
+#define STATS_SHM	"/mts-stats"
+#define STATS_MAGIC	"MTSSTATS"
+#define STATS_VERSION	4
+#define LAT_BUCKET	500 // microseconds per latency histogram bucket
+#define LAT_BUCKETS	200 // last one also counts anything later
+#define LAT_LIMIT	1000000 // microseconds, a stamp gone wrong if later
+
+// only the render thread writes the latency and output counts,
+// only the control loop writes ctlFull and streamFull, only the
+// stream thread the rest of the stream counts
+struct stats {
+  char magic[8];
+  uint32_t version, bucketUsec;
+  uint64_t latency[LAT_BUCKETS]; // sensed to heard, counts per bucket
+  uint64_t readings, latSum, latMax; // microseconds
+  uint64_t blocks, xruns, shortWrites; // from the sink
+  uint64_t ctlFull; // readings dropped as audio was stuck
+  uint64_t streamSent, streamDropped, streamFull; // controller readings
+  uint64_t fxBlocks, fxNs, fxMaxNs; // effects, per voice block
+  uint64_t queuedSum, writeSum; // frames in device and written, per block
+};
+
+extern struct stats *stats;
+extern volatile sig_atomic_t statsReq; // set by SIGUSR1
+
+void openStats();
+void noteLatency(struct timespec *sensed, long queued);
+void dumpStats(FILE *stm);
@@ -0,0 +1,376 @@
+// pitch and volume sent on to soft synths as they are sensed
+// copyright simulistics ltd
+// control loop drops each reading in a lock-free queue and carries on;
+// a thread of ordinary priority thins, batches and sends them, never
+// waiting on the network or MIDI port, so audio can't be held up
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "synth.h"
+#include "sense.h"
+#include "stats.h"
+#include "stream.h"
+
+#define MAX_BATCH	32
+#define OSC_MSG		40 // bytes in each message, see oscMessage
+#define MIDI_MAX	16 // most bytes one reading can make
+
+int streamBatch = STREAM_BATCH;
+double streamRate = 0;
+
+// single producer (control loop), single consumer (stream thread)
+static struct reading queue[STREAM_QUEUE];
+static atomic_uint head, tail;
+static sem_t ready;
+static struct streamOut *out = NULL;
+static int fd = -1;
+
+double pitchHz(pitch_t pitch) {
+#ifdef FIXED
+  return pitch*(double)PCM_RATE/4294967296.0;
+#else
+  return pitch;
+#endif
+}
+
+static long long nsNow(clockid_t clk) {
+  struct timespec tv;
+
+  clock_gettime(clk, &tv);
+  return tv.tv_sec*1000000000LL + tv.tv_nsec;
+}
+
+//// OSC over UDP: one message per reading, a bundle if more than one
+static unsigned char *put32(unsigned char *p, uint32_t x) {
+  p[0] = x>>24; p[1] = x>>16; p[2] = x>>8; p[3] = x;
+  return p+4;
+}
+
+static unsigned char *putFloat(unsigned char *p, float f) {
+  uint32_t x;
+
+  memcpy(&x, &f, 4);
+  return put32(p, x);
+}
+
+// strings are NUL terminated and padded to 4 bytes
+static unsigned char *putStr(unsigned char *p, char *s) {
+  int len = strlen(s)+1;
+
+  memset(p, 0, (len+3)&~3);
+  memcpy(p, s, len);
+  return p + ((len+3)&~3);
+}
+
+// timetag carries when it was sensed, by the player's CLOCK_MONOTONIC_RAW,
+// so a receiver on the same box can see how late it arrived
+static unsigned char *oscMessage(unsigned char *p, struct reading *r) {
+  p = putStr(p, STREAM_ADDR);
+  p = putStr(p, ",ifft");
+  p = put32(p, r->inst);
+  p = putFloat(p, pitchHz(r->pitch));
+  p = putFloat(p, r->vol/(double)VOL_ONE);
+  p = put32(p, r->sensed.tv_sec);
+  return put32(p, (uint64_t)r->sensed.tv_nsec*4294967296ULL/1000000000);
+}
+
+int oscPacket(unsigned char *buf, struct reading *r, int n) {
+  unsigned char *p = buf;
+  int i;
+
+  if (n == 1)
+    return oscMessage(p, r) - buf;
+  p = putStr(p, "#bundle");
+  p = put32(put32(p, 0), 1); // timetag 1 is immediately
+  for (i=0; i<n; ++i)
+    p = oscMessage(put32(p, OSC_MSG), r+i);
+  return p - buf;
+}
+
+// host:port or just port on this box
+static int oscOpen(char *arg) {
+  struct addrinfo hints, *ai;
+  char host[256] = "127.0.0.1", *port;
+  int err;
+
+  if (!arg) {
+    fprintf(stderr, "OSC output needs a port (-c osc:[host:]port)\n");
+    return 0;
+  }
+  if ((port = strrchr(arg, ':')))
+    snprintf(host, sizeof(host), "%.*s", (int)(port++ - arg), arg);
+  else
+    port = arg;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  if ((err = getaddrinfo(host, port, &hints, &ai))) {
+    fprintf(stderr, "OSC %s: %s\n", arg, gai_strerror(err));
+    return 0;
+  }
+  if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 ||
+      connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+    perror(arg);
+    freeaddrinfo(ai);
+    return 0;
+  }
+  freeaddrinfo(ai);
+  return 1;
+}
+
+static int oscSend(struct reading *r, int n) {
+  static unsigned char buf[16 + MAX_BATCH*(4+OSC_MSG)];
+
+  return send(fd, buf, oscPacket(buf, r, n), MSG_DONTWAIT) > 0;
+}
+
+//// MPE MIDI to a raw port: each instrument has its own member channel,
+// a note held while it sounds, pitch as 14-bit bend from that note and
+// volume as 14-bit expression; only what changed is sent
+static struct mpe {
+  int note, bend, expr; // -1 till first sent
+  int lost; // a write failed, so silence whatever it left sounding
+} mpes[MAX_INST], next[MAX_INST]; // as last written, as being built
+
+static int clamp(long x, int lo, int hi) {
+  return x < lo ? lo : x > hi ? hi : x;
+}
+
+// builds against next[], which midiSend only keeps if the write succeeds
+int midiBytes(unsigned char *buf, struct reading *r) {
+  struct mpe *m = next + r->inst;
+  int ch = 1 + r->inst, n = 0, note, bend, expr;
+  double hz = pitchHz(r->pitch), semi;
+
+  if (m->lost) { // all notes off
+    buf[n++] = 0xb0|ch; buf[n++] = 123; buf[n++] = 0;
+    m->lost = 0;
+  }
+  expr = clamp(lrint(16383.0*r->vol/VOL_ONE), 0, 16383);
+  if (!expr || hz <= 0) { // silent, let note go
+    if (m->note >= 0) {
+      buf[n++] = 0x80|ch; buf[n++] = m->note; buf[n++] = 0;
+      m->note = -1;
+    }
+    return n;
+  }
+  semi = 69 + 12*log2(hz/440);
+  note = m->note;
+  if (note < 0 || fabs(semi - note) >= MPE_BEND) // out of bend range
+    note = clamp(lrint(semi), 0, 127);
+  bend = clamp(8192 + lrint((semi-note)*8192/MPE_BEND), 0, 16383);
+  if (bend != m->bend || note != m->note) { // MPE wants bend before note
+    buf[n++] = 0xe0|ch; buf[n++] = bend&0x7f; buf[n++] = bend>>7;
+    m->bend = bend;
+  }
+  if (expr != m->expr || note != m->note) {
+    buf[n++] = 0xb0|ch; buf[n++] = 11; buf[n++] = expr>>7;
+    buf[n++] = 0xb0|ch; buf[n++] = 43; buf[n++] = expr&0x7f;
+    m->expr = expr;
+  }
+  if (note != m->note) { // new note first so it sounds legato
+    buf[n++] = 0x90|ch; buf[n++] = note; buf[n++] = 100;
+    if (m->note >= 0) {
+      buf[n++] = 0x80|ch; buf[n++] = m->note; buf[n++] = 0;
+    }
+    m->note = note;
+  }
+  return n;
+}
+
+// rpn on channel ch set to given 7-bit value
+static unsigned char *putRPN(unsigned char *p, int ch, int rpn, int val) {
+  unsigned char msg[] = {0xb0|ch, 101, 0, 100, rpn, 6, val, 38, 0,
+			 101, 127, 100, 127};
+
+  memcpy(p, msg, sizeof(msg));
+  return p + sizeof(msg);
+}
+
+// hw:card,device or a path, eg /dev/snd/midiC1D0 or a fifo
+static int midiOpen(char *arg) {
+  unsigned char buf[(MAX_INST+1)*13], *p = buf;
+  char path[256];
+  int card, dev = 0, i;
+
+  if (!arg) {
+    fprintf(stderr, "MIDI output needs a port (-c midi:hw:1,0)\n");
+    return 0;
+  }
+  if (sscanf(arg, "hw:%d,%d", &card, &dev) >= 1)
+    snprintf(path, sizeof(path), "/dev/snd/midiC%dD%d", card, dev);
+  else
+    snprintf(path, sizeof(path), "%s", arg);
+  if ((fd = open(path, O_WRONLY|O_NONBLOCK)) < 0) {
+    perror(path);
+    return 0;
+  }
+  // lower MPE zone with a member channel per instrument, bend range set
+  p = putRPN(p, 0, 6, MAX_INST);
+  for (i=0; i<MAX_INST; ++i) {
+    p = putRPN(p, 1+i, 0, MPE_BEND);
+    mpes[i].note = mpes[i].bend = mpes[i].expr = -1;
+    mpes[i].lost = 0;
+  }
+  return write(fd, buf, p-buf) == p-buf;
+}
+
+// a short write would split a message, so drop the lot rather;
+// channels it touched start afresh with the next reading
+static int midiSend(struct reading *r, int n) {
+  static unsigned char buf[MAX_BATCH*MIDI_MAX];
+  struct mpe *m;
+  int i, len = 0;
+
+  memcpy(next, mpes, sizeof(mpes));
+  for (i=0; i<n; ++i)
+    len += midiBytes(buf+len, r+i);
+  if (!len)
+    return 1;
+  if (write(fd, buf, len) == len) {
+    memcpy(mpes, next, sizeof(mpes));
+    return 1;
+  }
+  for (i=0; i<n; ++i) {
+    m = mpes + r[i].inst;
+    m->note = m->bend = m->expr = -1;
+    m->lost = 1;
+  }
+  return 0;
+}
+
+static struct streamOut outs[] = {
+  {"osc", oscOpen, oscSend},
+  {"midi", midiOpen, midiSend},
+};
+
+// queue a reading, never waits
+void streamCtl(int inst, pitch_t pitch, vol_t vol, struct timespec *sensed) {
+  unsigned int h = atomic_load_explicit(&head, memory_order_relaxed);
+  struct reading *r;
+
+  if (!out)
+    return;
+  if (h - atomic_load_explicit(&tail, memory_order_acquire) == STREAM_QUEUE) {
+    ++stats->streamFull;
+    return;
+  }
+  r = queue + h%STREAM_QUEUE;
+  r->inst = inst;
+  r->pitch = pitch;
+  r->vol = vol;
+  r->sensed = *sensed;
+  atomic_store_explicit(&head, h+1, memory_order_release);
+  sem_post(&ready);
+}
+
+static void flush(struct reading *batch, int *n) {
+  if (!*n)
+    return;
+  if (out->send(batch, *n))
+    stats->streamSent += *n;
+  else
+    stats->streamDropped += *n;
+  *n = 0;
+}
+
+// readings go out as they come, in packets of up to streamBatch;
+// with a rate limit, one too soon after the last for its instrument
+// waits, and is replaced by any newer one meanwhile
+static void* streamLoop(void* dump) {
+  struct reading batch[MAX_BATCH], held[MAX_INST], *r;
+  long long last[MAX_INST], due, now, wait;
+  int isHeld[MAX_INST], nb = 0, i;
+  unsigned int t;
+  struct timespec tv;
+
+  for (i=0; i<MAX_INST; ++i)
+    last[i] = isHeld[i] = 0;
+  for (;;) {
+    due = 0;
+    for (i=0; i<MAX_INST; ++i)
+      if (isHeld[i] && (!due || last[i] < due))
+	due = last[i];
+    if (!due)
+      while (sem_wait(&ready) && errno == EINTR)
+	;
+    else if ((wait = due + 1e9/streamRate - nsNow(CLOCK_MONOTONIC)) > 0) {
+      clock_gettime(CLOCK_REALTIME, &tv); // as sem_timedwait wants
+      wait += tv.tv_nsec;
+      tv.tv_sec += wait/1000000000;
+      tv.tv_nsec = wait%1000000000;
+      sem_timedwait(&ready, &tv);
+    }
+
+    now = nsNow(CLOCK_MONOTONIC);
+    t = atomic_load_explicit(&tail, memory_order_relaxed);
+    for (; t != atomic_load_explicit(&head, memory_order_acquire); ++t) {
+      r = queue + t%STREAM_QUEUE;
+      if (streamRate > 0 && now - last[r->inst] < 1e9/streamRate) {
+	held[r->inst] = *r;
+	isHeld[r->inst] = 1;
+      } else {
+	batch[nb++] = *r;
+	last[r->inst] = now;
+	isHeld[r->inst] = 0;
+	if (nb == streamBatch)
+	  flush(batch, &nb);
+      }
+      atomic_store_explicit(&tail, t+1, memory_order_release);
+    }
+    for (i=0; i<MAX_INST; ++i)
+      if (isHeld[i] && now - last[i] >= 1e9/streamRate) {
+	batch[nb++] = held[i];
+	last[i] = now;
+	isHeld[i] = 0;
+	if (nb == streamBatch)
+	  flush(batch, &nb);
+      }
+    flush(batch, &nb);
+  }
+  return NULL;
+}
+
+// spec is name:arg, eg osc:9000, osc:synth.local:57120 or midi:hw:1,0
+int openStream(char *spec) {
+  static int started = 0;
+  pthread_t threadId;
+  char *arg;
+  int i, len;
+
+  if (streamBatch < 1 || streamBatch > MAX_BATCH) {
+    fprintf(stderr, "Batch must be 1-%d readings\n", MAX_BATCH);
+    return 0;
+  }
+  arg = strchr(spec, ':');
+  len = arg ? arg++ - spec : strlen(spec);
+  for (i=0; i<sizeof(outs)/sizeof(*outs); ++i)
+    if (strlen(outs[i].name) == len && !strncmp(spec, outs[i].name, len)) {
+      if (fd >= 0)
+	close(fd);
+      if (!outs[i].open(arg)) return 0;
+      out = outs + i;
+      if (!started) {
+	sem_init(&ready, 0, 0);
+	pthread_create(&threadId, NULL, streamLoop, NULL);
+	started = 1;
+      }
+      return 1;
+    }
+  fprintf(stderr, "Unknown controller output %s, try osc or midi\n", spec);
+  return 0;
+}
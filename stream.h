@@ -0,0 +1,32 @@
+// pitch and volume sent on to soft synths as they are sensed
+// copyright simulistics ltd
+
+// needs synth.h and time.h
+
+#define STREAM_QUEUE	256 // readings in flight, power of 2
+#define STREAM_BATCH	8 // default most readings per packet
+#define STREAM_ADDR	"/mts/ctl" // OSC address, args inst, Hz, vol, sensed
+#define MPE_BEND	48 // semitones either way, the MPE default
+
+struct reading { // one per control loop update
+  int inst;
+  pitch_t pitch; // as sent to the synth
+  vol_t vol;
+  struct timespec sensed; // CLOCK_MONOTONIC_RAW, as getSnap gives
+};
+
+struct streamOut { // where readings go
+  char *name;
+  int (*open)(char *arg);
+  // n readings as one packet, returns 0 if it had to be dropped
+  int (*send)(struct reading *r, int n);
+};
+
+extern int streamBatch; // most readings per packet
+extern double streamRate; // most updates per second per instrument, 0 all
+
+int openStream(char *spec);
+void streamCtl(int inst, pitch_t pitch, vol_t vol, struct timespec *sensed);
+double pitchHz(pitch_t pitch);
+int oscPacket(unsigned char *buf, struct reading *r, int n);
+int midiBytes(unsigned char *buf, struct reading *r);
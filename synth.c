@@ -0,0 +1,229 @@
+// waveform generation for theremin player
+// copyright simulistics ltd
+
+#include <stdint.h>
+#include <math.h>
+#include <sys/param.h>
+
+#include "synth.h"
+
+char *toneNames[NTONES] = {
+  "sine", "classic", "valve", "triangle", "sawtooth", "square"
+};
+
+float waves[NTONES][WAVE_SIZ+1];
+#ifdef FIXED
+int16_t iwaves[NTONES][WAVE_SIZ+1];
+static uint32_t log2Tab[257], exp2Tab[257]; // Q16 log2, Q30 exp2 of 1+i/256
+#endif
+
+// direct calculation of tone at phase 0..1, range -1..1
+double oscSample(int tone, double phase) {
+  switch (tone) {
+  case SINE:      // sine wave (-cos = same phase as next two)
+    return -cos(2*3.14159*phase);
+  case CLASSIC:      // classic sound
+    return pow(4*phase*(1-phase),2)-1;
+  case VALVE:      // valve sound
+    return pow(4*phase*(1-phase),16)-1;
+  case TRIANGLE:       // triangle wave
+    return phase>0.5?3-4*phase:4*phase-1;
+  case SAWTOOTH:       // sawtooth wave
+    return 2*phase-1;
+  default:       // square wave
+    return phase>0.5?1:-1;
+  }
+}
+
+// fill tables once so render loop does no trig or powers
+void initWaves() {
+  int t, i;
+
+  for (t=0; t<NTONES; ++t)
+    for (i=0; i<=WAVE_SIZ; ++i)
+      waves[t][i] = oscSample(t, (double)i/WAVE_SIZ);
+#ifdef FIXED
+  for (t=0; t<NTONES; ++t)
+    for (i=0; i<=WAVE_SIZ; ++i)
+      iwaves[t][i] = MIN(lrint(32768*waves[t][i]), 32767);
+  for (i=0; i<=256; ++i) {
+    log2Tab[i] = lrint(65536*log2(1+i/256.0));
+    exp2Tab[i] = llrint(1073741824*exp2(i/256.0));
+  }
+#endif
+}
+
+#ifdef FIXED
+//// integer maths: tables are set up once, nothing here uses the FPU
+
+// log2 of x in Q16, off by under 1e-5
+int32_t fixLog2(uint32_t x) {
+  int n;
+  uint32_t i, r;
+
+  if (!x)
+    return -32*65536;
+  n = 31 - __builtin_clz(x);
+  x <<= 31-n; // 1.31 mantissa
+  i = (x >> 23) & 0xff;
+  r = (x >> 15) & 0xff;
+  return n*65536 + log2Tab[i] + (((log2Tab[i+1]-log2Tab[i])*r) >> 8);
+}
+
+// 2 to the power x, x in Q16, saturating
+uint32_t fixExp2(int32_t x) {
+  int n = x >> 16;
+  uint32_t i = (x >> 8) & 0xff, r = x & 0xff, m;
+
+  if (n >= 32)
+    return UINT32_MAX;
+  if (n < -1)
+    return 0;
+  m = exp2Tab[i] + (((exp2Tab[i+1]-exp2Tab[i])*r) >> 8); // Q30, 1..2
+  if (n < 30)
+    return m >> (30-n);
+  if (n == 31 && m >= 1U<<31)
+    return UINT32_MAX;
+  return m << (n-30);
+}
+
+// one tone from integer table: phase, interpolation and volume ramp
+// all whole numbers, as the float path but for rounding
+void renderTone(struct osc *o, int16_t *buffer, int n, int tone,
+		pitch_t pitchAdj, vol_t volAdj) {
+  int16_t *w = iwaves[tone];
+  uint32_t phase = o->phase, idx, frac;
+  int32_t samp;
+  int i;
+
+  for (i=0; i<n; ++i) {
+    o->pitch += pitchAdj;
+    phase += o->pitch;
+    o->vol += volAdj;
+    idx = phase >> (32-WAVE_BITS);
+    frac = (phase >> (32-WAVE_BITS-15)) & 0x7fff;
+    samp = w[idx] + (((w[idx+1]-w[idx])*(int32_t)frac) >> 15);
+    buffer[i] = ((int64_t)samp*o->vol) >> 30;
+  }
+  o->phase = phase;
+}
+
+#else
+
+//// block kernels: integer phase, one tone per kernel, 4 lanes at a time
+// gcc vector extensions become NEON on the Pi (if enabled) and SSE on x86
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+
+#define LANES 4
+#define PHASE_ONE 4294967296.0 // 2^32 = one cycle
+
+static inline v4sf vsine(v4sf p) { // -cos(2 pi p) = cos(2 pi (p-0.5))
+  v4sf x = 2*(float)M_PI*(p-0.5f), x2 = x*x;
+  // even Taylor series to x^16, error < 2e-7 for |x| <= pi
+  return 1 + x2*(-1/2.0f + x2*(1/24.0f + x2*(-1/720.0f + x2*(1/40320.0f +
+    x2*(-1/3628800.0f + x2*(1/479001600.0f + x2*(-1/87178291200.0f +
+    x2*(1/20922789888000.0f))))))));
+}
+
+static inline v4sf vclassic(v4sf p) {
+  v4sf q = 4*p*(1-p);
+
+  return q*q-1;
+}
+
+static inline v4sf vvalve(v4sf p) {
+  v4sf q = 4*p*(1-p);
+
+  q *= q; q *= q; q *= q; q *= q; // 16th power
+  return q-1;
+}
+
+static inline v4sf vtriangle(v4sf p) {
+  v4sf d = p-0.5f;
+  v4si sign = {0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff};
+
+  d = (v4sf)((v4si)d & sign); // fabs
+  return 1-4*d;
+}
+
+static inline v4sf vsawtooth(v4sf p) {
+  return 2*p-1;
+}
+
+static inline v4sf vsquare(v4sf p) {
+  v4sf half = {0.5f, 0.5f, 0.5f, 0.5f};
+
+  return -2*__builtin_convertvector(p > half, v4sf) - 1; // true is -1
+}
+
+// phase of sample k is phase + (k+1)inc + (k+1)(k+2)/2 incAdj, as the
+// scalar loop steps pitch then phase; uint32 arithmetic wraps cycles
+#define KERNEL(name, wave)						\
+static void name(struct osc *o, int16_t *buffer, int n,		\
+		 double pitchAdj, double volAdj) {			\
+  uint32_t inc = (int64_t)(o->pitch*PHASE_ONE/PCM_RATE);		\
+  int32_t incAdj = (int64_t)(pitchAdj*PHASE_ONE/PCM_RATE);		\
+  v4su k1 = {1, 2, 3, 4}, tri = {1, 3, 6, 10}, ph;			\
+  v4sf vk1 = {1, 2, 3, 4}, p, vol, out;				\
+  v4si samp;								\
+  int i, j;								\
+									\
+  for (i=0; i<n; i+=LANES) {						\
+    ph = o->phase + k1*inc + tri*(uint32_t)incAdj;			\
+    p = __builtin_convertvector((v4si)(ph>>8), v4sf)*(1.0f/16777216);	\
+    vol = 32768*((float)o->vol + vk1*(float)volAdj);			\
+    out = vol*wave(p);							\
+    samp = __builtin_convertvector(out, v4si);				\
+    for (j=0; j<LANES && i+j<n; ++j)					\
+      buffer[i+j] = samp[j];						\
+    o->phase += LANES*inc + 10*(uint32_t)incAdj;			\
+    inc += LANES*incAdj;						\
+    o->vol += LANES*volAdj;						\
+  }									\
+  if (n%LANES) { /* last pass went past end, step back */		\
+    for (j=n%LANES; j<LANES; ++j) {					\
+      o->phase -= inc;							\
+      inc -= incAdj;							\
+      o->vol -= volAdj;							\
+    }									\
+  }									\
+  o->pitch += n*pitchAdj;						\
+}
+
+KERNEL(kernelSine, vsine)
+KERNEL(kernelClassic, vclassic)
+KERNEL(kernelValve, vvalve)
+KERNEL(kernelTriangle, vtriangle)
+KERNEL(kernelSawtooth, vsawtooth)
+KERNEL(kernelSquare, vsquare)
+
+static void (*kernels[NTONES])(struct osc*, int16_t*, int, double, double) = {
+  kernelSine, kernelClassic, kernelValve,
+  kernelTriangle, kernelSawtooth, kernelSquare
+};
+
+// n frames of tone with pitch and volume stepped by given amounts per frame
+void renderTone(struct osc *o, int16_t *buffer, int n, int tone,
+		double pitchAdj, double volAdj) {
+  kernels[tone](o, buffer, n, pitchAdj, volAdj);
+}
+
+// same again a sample at a time from the wavetables, for checking
+void renderToneScalar(struct osc *o, int16_t *buffer, int n, int tone,
+		      double pitchAdj, double volAdj) {
+  double phase = o->phase/PHASE_ONE;
+  int i;
+
+  for (i=0; i<n; ++i) {
+    o->pitch += pitchAdj;
+    phase += o->pitch/PCM_RATE;
+    phase -= (int)phase; // cheaper than fmod
+    o->vol += volAdj;
+    buffer[i] = 32768*o->vol*waveSample(tone, phase);
+  }
+  o->phase = (uint32_t)(int64_t)(phase*PHASE_ONE);
+}
+#endif
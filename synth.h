@@ -0,0 +1,63 @@
+// waveform generation for theremin player
+// copyright simulistics ltd
+
+#ifndef PCM_RATE // set to the DAC's own rate to spare ALSA resampling
+#define PCM_RATE 44100
+#endif
+
+// tones
+#define	SINE		0
+#define	CLASSIC		1
+#define	VALVE		2
+#define	TRIANGLE	3
+#define	SAWTOOTH	4
+#define	SQUARE		5
+#define NTONES		6
+
+#define WAVE_BITS	12 // one cycle of each tone in table
+#define WAVE_SIZ	(1<<WAVE_BITS)
+
+#ifdef FIXED
+// integer only, for boards without a fast FPU: make fmts
+typedef int32_t pitch_t; // phase step per frame, 2^32 is one cycle
+typedef int32_t vol_t; // VOL_ONE is full scale
+#define VOL_ONE		(1<<30)
+#define FIX_ERROR	3 // most a sample may differ from float path
+#else
+typedef double pitch_t; // Hz
+typedef double vol_t;
+#define VOL_ONE		1.0
+#endif
+
+extern char *toneNames[NTONES];
+extern float waves[NTONES][WAVE_SIZ+1]; // extra entry for interpolation
+#ifdef FIXED
+extern int16_t iwaves[NTONES][WAVE_SIZ+1]; // what gets played
+#endif
+
+struct osc { // oscillator state carried between blocks
+  uint32_t phase; // fraction of a cycle
+  pitch_t pitch;
+  vol_t vol;
+};
+
+void initWaves();
+void renderTone(struct osc *o, int16_t *buffer, int n, int tone,
+		pitch_t pitchAdj, vol_t volAdj);
+#ifdef FIXED
+int32_t fixLog2(uint32_t x);
+uint32_t fixExp2(int32_t x);
+#else
+void renderToneScalar(struct osc *o, int16_t *buffer, int n, int tone,
+		      double pitchAdj, double volAdj);
+#endif
+double oscSample(int tone, double phase);
+
+// wave value at phase 0..1 by linear interpolation in table
+static inline double waveSample(int tone, double phase) {
+  double x = phase*WAVE_SIZ;
+  int i = (int)x;
+  float *w = waves[tone];
+
+  return w[i] + (x-i)*(w[i+1]-w[i]);
+}
@@ -0,0 +1,108 @@
+// trace points for where each thread spends its time
+// copyright simulistics ltd
+// any thread claims a slot in the ring with one atomic add, then marks
+// it done with the lap it was written on, so the dump can skip slots
+// being overwritten under it; nothing allocates or locks
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define MAX_TRACED	64 // threads named in the dump
+
+static struct traceSlot {
+  atomic_ulong done; // index+1 of event last written here
+  uint64_t ns; // CLOCK_MONOTONIC_RAW
+  const char *name;
+  int tid;
+  char phase; // B, E or i as Chrome has them
+} ring[TRACE_RING];
+static atomic_ulong next;
+
+static struct {
+  int tid;
+  const char *name;
+} threads[MAX_TRACED];
+static atomic_int nThreads;
+
+static __thread int myTid;
+volatile sig_atomic_t traceReq = 0;
+
+static void traceSignal(int signo) {
+  traceReq = 1;
+}
+
+void openTrace() {
+  signal(SIGUSR2, traceSignal);
+}
+
+void traceEvent(const char *name, char phase) {
+  unsigned long i = atomic_fetch_add_explicit(&next, 1,
+					      memory_order_relaxed);
+  struct traceSlot *s = ring + i%TRACE_RING;
+  struct timespec now;
+
+  if (!myTid)
+    myTid = syscall(SYS_gettid);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  atomic_store_explicit(&s->done, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  s->ns = now.tv_sec*1000000000ULL + now.tv_nsec;
+  s->name = name;
+  s->tid = myTid;
+  s->phase = phase;
+  atomic_store_explicit(&s->done, i+1, memory_order_release);
+}
+
+// calling thread shows under this name
+void traceThread(const char *name) {
+  int n = atomic_fetch_add(&nThreads, 1);
+
+  myTid = syscall(SYS_gettid);
+  if (n < MAX_TRACED) {
+    threads[n].tid = myTid;
+    threads[n].name = name;
+  }
+}
+
+// newest TRACE_RING events as Chrome trace JSON, returns 0 on failure
+int dumpTrace(char *fileName) {
+  unsigned long end = atomic_load(&next), i, done;
+  struct traceSlot s;
+  FILE *stm;
+  int n, first = 1;
+
+  if (!(stm = fopen(fileName, "w"))) {
+    perror(fileName);
+    return 0;
+  }
+  fprintf(stm, "{\"traceEvents\":[\n");
+  for (n=0; n<atomic_load(&nThreads) && n<MAX_TRACED; ++n, first = 0)
+    fprintf(stm, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+	    "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n",
+	    getpid(), threads[n].tid, threads[n].name);
+  for (i = end > TRACE_RING ? end-TRACE_RING : 0; i<end; ++i) {
+    done = atomic_load_explicit(&ring[i%TRACE_RING].done,
+				memory_order_acquire);
+    s = ring[i%TRACE_RING];
+    atomic_thread_fence(memory_order_acquire);
+    if (done != i+1 || atomic_load_explicit(&ring[i%TRACE_RING].done,
+					    memory_order_relaxed) != done)
+      continue; // not written yet, or lapped while we copied
+    fprintf(stm, "%s{\"ph\":\"%c\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+	    "\"ts\":%.3lf%s}", first ? "" : ",\n", s.phase, s.name,
+	    getpid(), s.tid, s.ns/1000.0, s.phase == 'i' ? ",\"s\":\"t\"" : "");
+    first = 0;
+  }
+  fprintf(stm, "\n]}\n");
+  fclose(stm);
+  fprintf(stderr, "Trace of %lu events written to %s\n",
+	  end < TRACE_RING ? end : TRACE_RING, fileName);
+  return 1;
+}
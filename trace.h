@@ -0,0 +1,33 @@
+// trace points for where each thread spends its time
+// copyright simulistics ltd
+// build with -DTRACE to turn them on, -DTRACE=2 to add every GPIO edge;
+// kill -USR2 then writes TRACE_FILE for chrome://tracing or Perfetto
+
+// needs signal.h
+
+#define TRACE_RING	65536 // events kept, power of 2
+#define TRACE_FILE	"mts-trace.json"
+
+#ifdef TRACE
+#define TRACE_BEGIN(name)	traceEvent(name, 'B')
+#define TRACE_END(name)		traceEvent(name, 'E')
+#define TRACE_MARK(name)	traceEvent(name, 'i')
+#define TRACE_THREAD(name)	traceThread(name)
+#else // nothing at all left in the code
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_MARK(name)
+#define TRACE_THREAD(name)
+#endif
+#if defined(TRACE) && TRACE > 1
+#define TRACE_EDGE(name)	traceEvent(name, 'i')
+#else
+#define TRACE_EDGE(name)
+#endif
+
+extern volatile sig_atomic_t traceReq; // set by SIGUSR2
+
+void openTrace();
+void traceEvent(const char *name, char phase); // name must live for good
+void traceThread(const char *name);
+int dumpTrace(char *fileName);
@@ -0,0 +1,122 @@
+// autotune: snapping pitch to notes of a scale by table lookup
+// copyright simulistics ltd
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "tune.h"
+
+struct scale scales[MAX_SCALES] = {
+  {"continuous"}, {"chromatic"}, {"major"}, {"black"},
+  {"floydian"}, {"arpeggio"}, {"aeolian"}
+};
+int nScales = AEOLIAN+1;
+
+// built-in scales worked out the long way, used to fill their tables
+double quantizeSlow(int mode, double tgt) {
+  int wrk;
+
+  switch (mode) {
+  case CHROMATIC:
+    tgt = exp(log(2)*round(12*log(tgt)/log(2))/12);
+    break;
+  case MAJOR:
+    wrk = round(7*log(tgt)/log(2));
+    tgt = exp(log(2)*((12*wrk+2)/7)/12.0);
+    break;
+  case BLACK:
+    wrk = round(5*log(tgt)/log(2));
+    tgt = exp(log(2)*((12*wrk-3)/5)/12.0);
+    break;
+  case FLOYDIAN:
+    tgt = exp(log(2)*round(4*log(tgt)/log(2))/4);
+    break;
+  case ARPEGGIO:
+    wrk = round(3*log(tgt)/log(2));
+    tgt = exp(log(2)*(wrk/3))*(4+wrk%3)/4;
+    break;
+  case AEOLIAN:
+    tgt = 2048*round(tgt/2048);
+    break;
+  }
+  return tgt;
+}
+
+// middle of octave fraction covered by each table entry
+static double stepPitch(int i) {
+  return 1 + (i+0.5)/SCALE_STEPS;
+}
+
+void initScales() {
+  int mode, i;
+
+  // integer maths in the rules goes wrong below octave 1,
+  // so work them out in the octave above 4096 and scale down
+  for (mode=CHROMATIC; mode<AEOLIAN; ++mode)
+    for (i=0; i<SCALE_STEPS; ++i)
+      scales[mode].note[i] = NOTE(quantizeSlow(mode, 4096*stepPitch(i))/4096);
+}
+
+// Scala .scl file: description, number of notes, then one note per
+// line as cents (has a point) or ratio; 1/1 is implied, last is the octave.
+// Snaps to nearest note, with tonic on the tuning note
+int loadScale(char *fileName) {
+  FILE *stm;
+  char line[256], *p;
+  double degs[SCALE_STEPS+2], y, best;
+  int n = -1, got = 0, desc = 0, i, k, num, den;
+  struct scale *sc = scales + nScales;
+
+  if (nScales == MAX_SCALES) {
+    fprintf(stderr, "Too many scales, %s not loaded\n", fileName);
+    return 0;
+  }
+  if (!(stm = fopen(fileName, "r"))) {
+    perror(fileName);
+    return 0;
+  }
+  p = strrchr(fileName, '/');
+  snprintf(sc->name, sizeof(sc->name), "%s", p ? p+1 : fileName);
+
+  degs[got++] = 0; // tonic, log2 of ratio
+  while ((n < 0 || got <= n) && fgets(line, sizeof(line), stm)) {
+    if (line[0] == '!') continue;
+    p = line + strspn(line, " \t");
+    if (!desc) { // first line describes scale
+      desc = 1;
+      continue;
+    }
+    if (n < 0) { // then how many notes
+      if (sscanf(p, "%d", &n) != 1 || n < 1 || n > SCALE_STEPS) break;
+      continue;
+    }
+    if (strcspn(p, ".") < strcspn(p, " \t\r\n")) // cents
+      degs[got++] = atof(p)/1200;
+    else if ((k = sscanf(p, "%d/%d", &num, &den)) >= 1 && num > 0) {
+      if (k == 1 || den <= 0) den = 1;
+      degs[got++] = log2((double)num/den);
+    } else
+      break;
+  }
+  fclose(stm);
+
+  if (n < 1 || got != n+1 || fabs(degs[n]-1) > 1e-6) {
+    fprintf(stderr, "%s: not a Scala scale with an octave period\n",
+	    fileName);
+    return 0;
+  }
+  degs[n+1] = degs[n-1]-1; // top note of octave below
+  for (i=0; i<SCALE_STEPS; ++i) {
+    y = log2(stepPitch(i));
+    best = 0;
+    for (k=0; k<=n+1; ++k)
+      if (fabs(degs[k]-y) < fabs(best-y))
+	best = degs[k];
+    sc->note[i] = NOTE(exp2(best));
+  }
+  fprintf(stderr, "Scale %d: %s, %d notes\n", nScales, sc->name, n);
+  return ++nScales;
+}
@@ -0,0 +1,67 @@
+// autotune: snapping pitch to notes of a scale by table lookup
+// copyright simulistics ltd
+
+// autotune modes, scales loaded from files follow these
+#define CONTINUOUS      0
+#define CHROMATIC       1
+#define MAJOR           2
+#define BLACK           3
+#define FLOYDIAN        4
+#define ARPEGGIO        5
+#define AEOLIAN         6
+
+#define MAX_SCALES	16
+#define SCALE_BITS	12
+#define SCALE_STEPS	(1<<SCALE_BITS) // table entries per octave
+
+#ifdef FIXED
+typedef uint32_t note_t; // Q16
+#define NOTE(x)		((note_t)lrint((x)*65536))
+#define TUNE_ONE	(1<<20) // tuning note in quantize units
+#else
+typedef float note_t;
+#define NOTE(x)		(x)
+#define TUNE_ONE	4096
+#endif
+
+struct scale {
+  char name[32];
+  note_t note[SCALE_STEPS]; // pitch to play for each part of octave, 1..2
+};
+
+extern struct scale scales[MAX_SCALES];
+extern int nScales;
+
+void initScales();
+int loadScale(char *fileName);
+double quantizeSlow(int mode, double tgt);
+
+#ifdef FIXED
+// pitch snapped to scale, in units where TUNE_ONE is the tuning note
+static inline uint32_t quantize(int mode, uint32_t tgt) {
+  int oct;
+  uint32_t i;
+
+  if (mode == CONTINUOUS || !tgt)
+    return tgt;
+  if (mode == AEOLIAN) // harmonics of low note, not octave based
+    return (tgt + TUNE_ONE/4) / (TUNE_ONE/2) * (TUNE_ONE/2);
+  oct = 31 - __builtin_clz(tgt); // 2^oct <= tgt < 2^(oct+1)
+  i = (oct >= SCALE_BITS ? tgt >> (oct-SCALE_BITS) : tgt << (SCALE_BITS-oct))
+    - SCALE_STEPS;
+  return (uint64_t)scales[mode].note[i] << oct >> 16;
+}
+#else
+// pitch snapped to scale, in units where TUNE_ONE is the tuning note
+static inline double quantize(int mode, double tgt) {
+  int oct;
+  double m;
+
+  if (mode == CONTINUOUS || tgt <= 0)
+    return tgt;
+  if (mode == AEOLIAN) // harmonics of low note, not octave based
+    return 2048*round(tgt/2048);
+  m = frexp(tgt, &oct); // 0.5 <= m < 1
+  return ldexp(scales[mode].note[(int)((2*m-1)*SCALE_STEPS)], oct-1);
+}
+#endif
@@ -1,32 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <signal.h>
 #include <time.h>
 #include <byteswap.h>
 #include <sys/param.h>
 
 #include <unistd.h>
-#include <wiringPiSPI.h>
 
-#define SPI_BUF 1024
-#define FASTCLK 200000000
-#define TIMECONST 0.04
+#include "scan.h"
+#include "spi.h"
+#include "sense.h"
+#include "snap.h"
+#include "est.h"
+#include "calib.h"
+#include "rt.h"
+#include "trace.h"
 
 // for custom hardware
 #define UNCERTAINTY 	50000 // of osc freqs
 #define IF_MIN 		3000 // freq offset of reference oscs at idle
 #define IF_MAX 		25000 // biggest offset it can cope with
 #define SUBSAMPLE 	1 // set higher to check osc cycles periodically
+#define IF_CYCLES	24 // per capture, enough for the estimator's precision
 
 volatile int rateP, rateV;
-volatile double pitch_if = 3000, vol_if = 3000;
-volatile struct timespec pitch_ts, vol_ts;
-
-// avoid need to link all of wiringPi
-int wiringPiFailure(int msg, char* full, char* rest) {
-  fprintf(stderr, "Error %d us %s them %s\n", msg, full, rest);
-  exit(msg);
-}
+volatile int lenP = SPI_BUF, lenV = SPI_BUF; // capture lengths wanted
+volatile double pitch_if = 3000, vol_if = 3000; // live, for calibration
+static volatile double resetTo[2]; // calibration restarting estimates
 
 // stuff for clean shutdown, needed by gpio
 void sig_handler(int signo)
@@ -40,61 +41,40 @@ void sig_handler(int signo)
   }
 }
 
-// return posn of 1st bit in buffer >= toChk not current
-int find_transition(int side, char bufr[], int toChk, int current) {
-  int wrd, slot, bit;
-  int masks[3] = {0x000000ff, 0xffff0000, 0x00ffffff};
-
-  while (toChk < 8*SPI_BUF) {
-    wrd = toChk/32;
-
-    slot = __bswap_32(((int*)bufr)[wrd]) ^ -current;
-    if (side) {
-      slot ^= masks[wrd%3]; // when using spi1, phase reverses every 24 bits
-    }
-    if (slot) { // not whole word of current value
-      bit = toChk%32;
-      bit = __builtin_clz(slot<<bit);
-      if (bit<32) return toChk+bit;
-    }
-    toChk = 32*(wrd+1);
-  }
-  return 0; // transition not found in remainder of buffer
-}
-
 void* readOscs (void* dump) {
-  int side, chnl, res, rate, current, toChk, cycles, period;
-  struct timespec *tv;
+  int side, rate, len, current, toChk, cycles, period, n, j, full;
+  volatile int *want;
   volatile double *freq;
-  unsigned char bufr[SPI_BUF];
+  unsigned char *bufr;
+  int posns[8*SPI_BUF];
+  struct timespec stamps[2];
+  double ifs[2];
+  struct est est;
 
   side = (int)dump; // it fits -- wear it
+  freq = side ? &vol_if : &pitch_if;
+  want = side ? &lenV : &lenP;
+  estInit(&est, *freq);
+  // device stays open, next buffer captured while we decode this one
+  spiStart(side, side ? &rateV : &rateP, want);
   for (;;) {
-    if (side) {
-      rate = rateV;
-      freq = &vol_if;
-      tv = &vol_ts;
-    } else {
-      rate = rateP;
-      freq = &pitch_if;
-      tv = &pitch_ts;
-    }
-
-// get data from my wiringpi -- side now selects module not chip
-   chnl = wiringPiSPISetup(side, FASTCLK/rate);
-   res = wiringPiSPIDataRW(side, bufr, SPI_BUF);
-   close(chnl);
-   clock_gettime(CLOCK_MONOTONIC_RAW, tv);
-
-    if (res < SPI_BUF) {
-      printf("Only got %d bytes!\n", res);
-      continue;
+    TRACE_BEGIN("capture wait");
+    bufr = spiNext(side, stamps+side, &rate, &len);
+    TRACE_END("capture wait");
+    TRACE_BEGIN("decode");
+    if (resetTo[side]) {
+      estInit(&est, resetTo[side]);
+      resetTo[side] = 0;
     }
-    toChk = 0;
+    estBreak(&est); // time between captures is unknown
+    toChk = full = 0;
     int last[2] = {0, 0};
     current = bufr[0] >> 7; // first bit in buffer
 
-    while (toChk = find_transition(side, bufr, toChk+1, current)) {
+    n = scanTransitions(side, bufr, len, posns); // all edges in one pass
+    j = 0;
+    while (toChk = next_transition(posns, n, len, &j, bufr[0] >> 7,
+				   toChk+1, current)) {
       current = !current;
       if (side) {
 	cycles = 0.5+26.5*(toChk/24)-1.25*(!toChk%24); 
@@ -104,73 +84,49 @@ void* readOscs (void* dump) {
       }
       if (last[current]) { // full cycle read -- update freq estimate
         period = rate*(cycles - last[current]);
-        *freq = (1 - period/(TIMECONST*FASTCLK))*(*freq) + 1/TIMECONST;
+        *freq = estUpdate(&est, (double)period/FASTCLK,
+			  (double)rate*(cycles - last[!current])/FASTCLK);
+	++full;
       }
       last[current] = cycles;
 
       toChk += FASTCLK*0.05/(*freq)/rate; // jump over jitter
     }
     // TODO if no last, reduce freq to show it out of range!
-
+    spiDone(side);
+    // next captures just long enough for IF_CYCLES at this IF; whole
+    // buffers until one shows a cycle, so a wrong guess can't starve it
+    *want = full ? spiLen(*freq, rate, IF_CYCLES) : SPI_BUF;
+    ifs[side] = *freq;
+    snapPublish(0, 1<<side, ifs, stamps);
+    TRACE_END("decode");
   }
 }
 
-void getIFs(int *p, int *v) {
-  *p = (int)pitch_if;
-  *v = (int)vol_if;
+//// calibration, both antennas at once
+static int setClock(int s, int freq) {
+  int rate = FASTCLK/freq;
+
+  if (s) rateV = rate; else rateP = rate;
+  return FASTCLK/rate; // actual rather than chosen clock
 }
 
-void getTSs(int *p, int *v) {
-  *p = pitch_ts.tv_nsec;
-  *v = vol_ts.tv_nsec;
+static void restartIFs() {
+  pitch_if = vol_if = resetTo[0] = resetTo[1] = UNCERTAINTY;
+  lenP = lenV = SPI_BUF;
 }
 
-void calibrate(int guess0, int guess1) {  // try to find osc freq
-  struct timespec tv;
-  double freq[2], low[2] = {0,0}, high[2] = {0,0};
-  int base[2] = {0,0}, top[2] = {0,0}, i, b, s;
-  tv.tv_sec = 0;
-  tv.tv_nsec = 0.2e9;
-
-  printf("P clock beat    loAlias hiAlias V clock beat    loAlias hiAlias\n");
-  for (i=-UNCERTAINTY; i<=UNCERTAINTY;i += IF_MAX-IF_MIN) { 
-    // range over which to search --
-    // increment equal to useful range so one reading will be within
-    rateP = FASTCLK/(guess0+i);
-    rateV = FASTCLK/(guess1+i);
-    pitch_if = vol_if = 50000;
-    nanosleep(&tv, NULL); // delay 0.2 sec to home to frequency
-
-    freq[0] = pitch_if;
-    freq[1] = vol_if;
-    for (s=0;s<2;++s) { // calibrate both oscs at once
-      b = FASTCLK/(s?rateV:rateP); // actual rather than chosen clock
-      printf("%6d  %6.0lf  %6.0lf  %.0lf  ", b, freq[s], b-freq[s], b+freq[s]);
-      if (freq[s] >= IF_MIN && freq[s] < IF_MAX) { // a valid reading
-	if (low[s] == 0) { // first one, clock is below osc freq
-	  low[s] = freq[s];
-	  base[s] = b;
-	} else if (b+freq[s] > base[s]+low[s]+IF_MIN) { 
-	  // clock now above osc freq
-	  high[s] = freq[s];
-          top[s] = b;
-	}
-      }
-    }
-    printf("\n");
-  }
-  for (s=0;s<2;++s) {
-    i = (top[s]*low[s] + base[s]*high[s])/(low[s]+high[s]) + IF_MIN; 
-    // set clk to osc freq plus quiescent IF
-    b = FASTCLK/i;
-    if (s) rateV = b; else rateP = b;
-    fprintf(stderr, "Osc %d %d at %d\n", s, b, i);
-  }
-  //  pitch_if = vol_if = IF_MIN;
+static void readIFs(double ifs[2]) {
+  ifs[0] = pitch_if;
+  ifs[1] = vol_if;
 }
 
-void setupSensing () {
-  pthread_t threadId;
+static struct calibOps calibOps = {
+  "umts", IF_MIN, IF_MAX, UNCERTAINTY, 0, setClock, restartIFs, readIFs
+};
+
+int setupSensing () {
+  int guess[2], clocks[2];
 
   // Prepare clean shutdown
   if (signal(SIGHUP, sig_handler) == SIG_ERR)
@@ -182,12 +138,17 @@ void setupSensing () {
   if (signal(SIGTERM, sig_handler) == SIG_ERR)
     fprintf(stderr, "\ncan't catch SIGTERM\n");
 
-  pitch_if = 570000; // guesses around which to search
-  vol_if = 520000;
-  pthread_create(&threadId, NULL, readOscs, (void*)0);
-  pthread_create(&threadId, NULL, readOscs, (void*)1);
-
-  calibrate(pitch_if, vol_if);
+  pitch_if = guess[0] = 570000; // guesses around which to search
+  vol_if = guess[1] = 520000;
+  rateP = FASTCLK/pitch_if; // capture needs a clock from the start
+  rateV = FASTCLK/vol_if;
+  startThread(RT_SENSE, readOscs, (void*)0);
+  startThread(RT_SENSE, readOscs, (void*)1);
+
+  // buffers already captured at old clocks have to drain first
+  calibOps.settleNs = estKind == TRACK ? 100000000 : 200000000;
+  calibrate(&calibOps, guess, clocks);
+  return 1; // one antenna pair
 }
 
 /* Include this to serve sensed values to stdin/stdout
@@ -206,7 +167,7 @@ int main () {
     scanf("%c\n", &q);
     if (q == '?') continue; // sent as filler
     if (q == '!') sig_handler(SIGCONT); // leave
-    getIFs(&p, &v);
+    getIFs(0, &p, &v);
     printf("%c v%d p%d f%d\n? 0 0\n", q, v, p, fails);
     fflush(stdout);
   }
@@ -0,0 +1,104 @@
+// spoken prompts, all loaded before playing starts
+// copyright simulistics ltd
+// no file access once the instrument is running
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synth.h"
+#include "voice.h"
+
+double duck = 0.25;
+
+static struct prompt prompts[] = {
+  {"autotune.wav"}, {"prange.wav"}, {"standby.wav"}, {"tuning.wav"},
+  {"play.wav"}, {"pslope.wav"}, {"tone.wav"}, {"vrange.wav"},
+  {"effect.wav"}, {"fxamount.wav"}
+};
+#define NPROMPTS (sizeof(prompts)/sizeof(*prompts))
+
+static uint32_t le32(unsigned char *p) {
+  return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+static uint16_t le16(unsigned char *p) {
+  return p[0] | p[1]<<8;
+}
+
+// walk RIFF chunks for format and data, 16-bit PCM only;
+// stereo mixed down to mono
+static int parseWav(struct prompt *pr, unsigned char *wav, long siz) {
+  unsigned char *chunk, *fmt = NULL, *data = NULL;
+  uint32_t chunkSiz, dataSiz = 0;
+  int chans, i, c, sum;
+
+  if (siz < 12 || memcmp(wav, "RIFF", 4) || memcmp(wav+8, "WAVE", 4))
+    return 0;
+  for (chunk = wav+12; chunk+8 <= wav+siz;
+       chunk += 8 + chunkSiz + (chunkSiz&1)) { // chunks are word aligned
+    chunkSiz = le32(chunk+4);
+    if (chunkSiz > wav+siz-chunk-8) // truncated file, use what's there
+      chunkSiz = wav+siz-chunk-8;
+    if (!memcmp(chunk, "fmt ", 4) && chunkSiz >= 16)
+      fmt = chunk+8;
+    else if (!memcmp(chunk, "data", 4)) {
+      data = chunk+8;
+      dataSiz = chunkSiz;
+    }
+  }
+  if (!fmt || !data || le16(fmt) != 1 || le16(fmt+14) != 16) {
+    fprintf(stderr, "%s: not 16-bit PCM WAV\n", pr->name);
+    return 0;
+  }
+  chans = le16(fmt+2);
+  if (chans < 1) return 0;
+  if (le32(fmt+4) != PCM_RATE)
+    fprintf(stderr, "%s: %u Hz, will play at %d\n", pr->name,
+	    le32(fmt+4), PCM_RATE);
+
+  pr->len = dataSiz/(2*chans);
+  if (!(pr->data = malloc(2*pr->len))) return 0;
+  for (i=0; i<pr->len; ++i) {
+    for (c=sum=0; c<chans; ++c)
+      sum += (int16_t)le16(data + 2*(i*chans + c));
+    pr->data[i] = sum/chans;
+  }
+  return 1;
+}
+
+// read every prompt into memory, returns how many loaded
+int loadPrompts() {
+  char path[256];
+  unsigned char *wav;
+  FILE *stm;
+  long siz;
+  int i, n = 0;
+
+  for (i=0; i<NPROMPTS; ++i) {
+    snprintf(path, sizeof(path), VOICE_DIR "%s", prompts[i].name);
+    if (!(stm = fopen(path, "rb"))) {
+      perror(path);
+      continue;
+    }
+    fseek(stm, 0, SEEK_END);
+    siz = ftell(stm);
+    rewind(stm);
+    if ((wav = malloc(siz)) && fread(wav, 1, siz, stm) == siz &&
+	parseWav(prompts+i, wav, siz))
+      ++n;
+    free(wav);
+    fclose(stm);
+  }
+  return n;
+}
+
+struct prompt *findPrompt(char *name) {
+  int i;
+
+  for (i=0; i<NPROMPTS; ++i)
+    if (!strcmp(prompts[i].name, name))
+      return prompts[i].data ? prompts+i : NULL;
+  return NULL;
+}
@@ -0,0 +1,15 @@
+// spoken prompts, all loaded before playing starts
+// copyright simulistics ltd
+
+#define VOICE_DIR	"/usr/local/lib/mts/"
+
+struct prompt {
+  char *name;
+  int16_t *data; // mono at PCM_RATE, NULL if it wouldn't load
+  int len; // frames
+};
+
+extern double duck; // tone level under speech
+
+int loadPrompts();
+struct prompt *findPrompt(char *name);